@@ -9,19 +9,29 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cmath>
 
 namespace local = baofit;
 
+namespace baofit {
+    // The largest relative change in a diagonal inverse covariance element that we attribute to
+    // round-off when checking if our recorded inverse covariance elements are still valid.
+    double const maxDiagonalChange = 1e-10;
+}
+
 local::AbsCorrelationData::AbsCorrelationData(
 likely::AbsBinningCPtr axis1, likely::AbsBinningCPtr axis2, likely::AbsBinningCPtr axis3,
 TransverseBinningType type)
-: likely::BinnedData(axis1,axis2,axis3), _type(type), _haveFinalCuts(false)
+: likely::BinnedData(axis1,axis2,axis3), _type(type), _haveFinalCuts(false),
+_haveIcovElements(false), _sortedIcovElements(true)
 {
 }
 
 local::AbsCorrelationData::AbsCorrelationData(std::vector<likely::AbsBinningCPtr> axes,
 TransverseBinningType type)
-: likely::BinnedData(axes), _type(type), _haveFinalCuts(false)
+: likely::BinnedData(axes), _type(type), _haveFinalCuts(false),
+_haveIcovElements(false), _sortedIcovElements(true)
 {
 }
 
@@ -31,6 +41,14 @@ double local::AbsCorrelationData::getCosAngle(int index) const { return 0; }
 
 cosmo::Multipole local::AbsCorrelationData::getMultipole(int index) const { return cosmo::Monopole; }
 
+void local::AbsCorrelationData::getBinQuadrature(int index, int order, std::vector<double> &r,
+std::vector<double> &mu, std::vector<double> &z, std::vector<double> &weight) const {
+    r.assign(1,getRadius(index));
+    mu.assign(1,getCosAngle(index));
+    z.assign(1,getRedshift(index));
+    weight.assign(1,1);
+}
+
 void local::AbsCorrelationData::setFinalCuts(double rMin, double rMax, double rVetoMin, double rVetoMax,
 double muMin, double muMax, cosmo::Multipole lMin, cosmo::Multipole lMax,
 double zMin, double zMax) {
@@ -119,3 +137,59 @@ void local::AbsCorrelationData::saveInverseCovariance(std::string const &filenam
     }
     out.close();
 }
+
+void local::AbsCorrelationData::setSparseInverseCovariance(int index1, int index2, double value) {
+    setInverseCovariance(index1,index2,value);
+    _haveIcovElements = true;
+    if(index1 == index2) {
+        _icovDiagonal[index1] = value;
+        return;
+    }
+    _icovElements.push_back(index1 > index2 ?
+        std::make_pair(index1,index2) : std::make_pair(index2,index1));
+    _sortedIcovElements = false;
+}
+
+bool local::AbsCorrelationData::getInverseCovarianceElements(
+std::vector<std::pair<int,int> > &elements) const {
+    if(!_haveIcovElements) return false;
+    // Check that each diagonal element still has its recorded value (or zero, if none was recorded),
+    // allowing for round-off when our inverse covariance was summed from other datasets.
+    for(IndexIterator iter = begin(); iter != end(); ++iter) {
+        int index(*iter);
+        std::map<int,double>::const_iterator found = _icovDiagonal.find(index);
+        double expected = (found == _icovDiagonal.end()) ? 0 : found->second;
+        double actual = getInverseCovariance(index,index);
+        if(std::fabs(actual - expected) > maxDiagonalChange*std::max(std::fabs(actual),std::fabs(expected))) {
+            return false;
+        }
+    }
+    if(!_sortedIcovElements) {
+        std::sort(_icovElements.begin(),_icovElements.end());
+        _icovElements.erase(std::unique(_icovElements.begin(),_icovElements.end()),_icovElements.end());
+        _sortedIcovElements = true;
+    }
+    elements = _icovElements;
+    return true;
+}
+
+void local::AbsCorrelationData::addInverseCovarianceElements(AbsCorrelationData const &other) {
+    std::vector<std::pair<int,int> > elements;
+    if(!other.getInverseCovarianceElements(elements)) {
+        throw RuntimeError("AbsCorrelationData::addInverseCovarianceElements: other elements unknown.");
+    }
+    _icovElements.insert(_icovElements.end(),elements.begin(),elements.end());
+    for(std::map<int,double>::const_iterator iter = other._icovDiagonal.begin();
+    iter != other._icovDiagonal.end(); ++iter) {
+        _icovDiagonal[iter->first] += iter->second;
+    }
+    _haveIcovElements = true;
+    _sortedIcovElements = false;
+}
+
+void local::AbsCorrelationData::forgetInverseCovarianceElements() {
+    _haveIcovElements = false;
+    _sortedIcovElements = true;
+    std::vector<std::pair<int,int> >().swap(_icovElements);
+    _icovDiagonal.clear();
+}
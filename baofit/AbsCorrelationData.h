@@ -8,6 +8,10 @@
 
 #include "cosmo/types.h"
 
+#include <vector>
+#include <map>
+#include <utility>
+
 namespace baofit {
 	class AbsCorrelationData : public likely::BinnedData {
 	// Represents data binned in variables that map to the (r,mu,z) coordinates
@@ -33,6 +37,14 @@ namespace baofit {
         virtual cosmo::Multipole getMultipole(int index) const;
         // Returns the redshift associated with the specified global index.
         virtual double getRedshift(int index) const = 0;
+        // Fills the vectors provided with the (r,mu,z) coordinates and weights of a quadrature rule
+        // for averaging a prediction over the extent of the bin with the specified global index,
+        // using order nodes along each binned transverse direction. The weights sum to one and
+        // account for the density of pairs within the bin. Will only be called if
+        // getTransverseBinningType() returns Coordinate. The default implementation uses a single
+        // node at the bin's coordinates.
+        virtual void getBinQuadrature(int index, int order, std::vector<double> &r,
+            std::vector<double> &mu, std::vector<double> &z, std::vector<double> &weight) const;
         // Records the final cuts that should be applied when this dataset is finalized.
         // It is up to subclasses to actually implement these cuts using the protected
         // _applyFinalCuts method in their finalize() implementation. Throws a RuntimeError
@@ -51,6 +63,24 @@ namespace baofit {
         // where value = scale*getInverseCovariance(index1,index2). Lines with value==0
         // or index2 < index1 are not written to the file.
         void saveInverseCovariance(std::string const &filename, double scale = 1) const;
+        // Sets the inverse covariance element (index1,index2) and records it as one of the only
+        // elements that can be nonzero, together with its value when it is on the diagonal. Loaders
+        // that read a sparse inverse covariance should set all of its elements this way, so that a
+        // CorrelationFitter can copy it using O(nnz) instead of O(n^2) lookups.
+        void setSparseInverseCovariance(int index1, int index2, double value);
+        // Fills the vector provided with the global indices (index1,index2), with index1 > index2,
+        // of every off-diagonal inverse covariance element that might be nonzero, sorted and with no
+        // duplicates, and returns true. Returns false if we do not know which elements are nonzero,
+        // which includes any bin whose diagonal inverse covariance no longer has the value recorded
+        // for it, since that means our covariance has been modified some other way (for example, by
+        // projectOntoModes or rescaleEigenvalues) after the elements were recorded.
+        bool getInverseCovarianceElements(std::vector<std::pair<int,int> > &elements) const;
+        // Adds the elements that might be nonzero in the other dataset's inverse covariance to our
+        // list, and its diagonal values to ours. Use this when our inverse covariance is a sum of
+        // inverse covariances. Throws a RuntimeError if the other elements are not known.
+        void addInverseCovarianceElements(AbsCorrelationData const &other);
+        // Forgets which inverse covariance elements might be nonzero.
+        void forgetInverseCovarianceElements();
     protected:
         // Copies our final cuts to the specified object.
         void _cloneFinalCuts(AbsCorrelationData &other) const;
@@ -63,6 +93,13 @@ namespace baofit {
         double _rMin,_rMax,_rVetoMin,_rVetoMax,_muMin,_muMax,_zMin,_zMax;
         cosmo::Multipole _lMin,_lMax;
         bool _haveFinalCuts;
+        // The off-diagonal inverse covariance elements that might be nonzero, if we know them.
+        // They are sorted and de-duplicated on demand. The diagonal values that were recorded
+        // with them are used to detect any later changes to our covariance.
+        bool _haveIcovElements;
+        mutable bool _sortedIcovElements;
+        mutable std::vector<std::pair<int,int> > _icovElements;
+        std::map<int,double> _icovDiagonal;
 	}; // AbsCorrelationData
 	
 	inline AbsCorrelationData::TransverseBinningType
@@ -2,33 +2,166 @@
 
 #include "baofit/AbsCorrelationModel.h"
 #include "baofit/RuntimeError.h"
+#include "baofit/EvaluationContext.h"
 
 #include <cmath>
 
 namespace local = baofit;
 
 local::AbsCorrelationModel::AbsCorrelationModel(std::string const &name)
-: FitModel(name), _indexBase(-1)
-{ }
+: FitModel(name), _indexBase(-1), _anyChanged(false), _redshiftTerm(-1)
+{
+    // Create the evaluation context used by evaluate() and evaluateBatch().
+    _defaultContext.reset(new EvaluationContext());
+}
 
 local::AbsCorrelationModel::~AbsCorrelationModel() { }
 
 double local::AbsCorrelationModel::evaluate(double r, double mu, double z,
 likely::Parameters const &params) {
-    bool anyChanged = updateParameterValues(params);
-    double result = _evaluate(r,mu,z,anyChanged);
-    resetParameterValuesChanged();
+    double result;
+    beginEvaluation(params);
+    bindRange(1,&r,&mu,&z,_getDefaultContext());
+    _evaluateBatch(1,&r,&mu,&z,&result,_getDefaultContext());
+    endEvaluation();
     return result;
 }
 
 double local::AbsCorrelationModel::evaluate(double r, cosmo::Multipole multipole, double z,
 likely::Parameters const &params) {
-    bool anyChanged = updateParameterValues(params);
-    double result = _evaluate(r,multipole,z,anyChanged);
-    resetParameterValuesChanged();
+    double result;
+    beginEvaluation(params);
+    bindRange(1,&r,&multipole,&z,_getDefaultContext());
+    _evaluateBatch(1,&r,&multipole,&z,&result,_getDefaultContext());
+    endEvaluation();
     return result;
 }
 
+void local::AbsCorrelationModel::evaluateBatch(std::vector<double> const &r, std::vector<double> const &mu,
+std::vector<double> const &z, likely::Parameters const &params, std::vector<double> &result) {
+    int n(r.size());
+    if(mu.size() != n || z.size() != n) {
+        throw RuntimeError("AbsCorrelationModel::evaluateBatch: input vectors have different sizes.");
+    }
+    result.resize(n);
+    beginEvaluation(params);
+    if(n > 0) {
+        // The vectors might reuse the storage of a previous batch, so always bind explicitly.
+        bindRange(n,&r[0],&mu[0],&z[0],_getDefaultContext());
+        _evaluateBatch(n,&r[0],&mu[0],&z[0],&result[0],_getDefaultContext());
+    }
+    endEvaluation();
+}
+
+void local::AbsCorrelationModel::evaluateBatch(std::vector<double> const &r,
+std::vector<cosmo::Multipole> const &multipole, std::vector<double> const &z,
+likely::Parameters const &params, std::vector<double> &result) {
+    int n(r.size());
+    if(multipole.size() != n || z.size() != n) {
+        throw RuntimeError("AbsCorrelationModel::evaluateBatch: input vectors have different sizes.");
+    }
+    result.resize(n);
+    beginEvaluation(params);
+    if(n > 0) {
+        bindRange(n,&r[0],&multipole[0],&z[0],_getDefaultContext());
+        _evaluateBatch(n,&r[0],&multipole[0],&z[0],&result[0],_getDefaultContext());
+    }
+    endEvaluation();
+}
+
+void local::AbsCorrelationModel::beginEvaluation(likely::Parameters const &params) {
+    _anyChanged = updateParameterValues(params);
+    // Advance the generation of any term that depends on a parameter whose value has changed.
+    if(_anyChanged) {
+        for(int term = 0; term < _termDependencies.size(); ++term) {
+            std::vector<int> const &dependencies = _termDependencies[term];
+            for(int k = 0; k < dependencies.size(); ++k) {
+                if(isParameterValueChanged(dependencies[k])) {
+                    ++_termGeneration[term];
+                    break;
+                }
+            }
+        }
+    }
+    _prepareEvaluation(_anyChanged);
+}
+
+void local::AbsCorrelationModel::endEvaluation() {
+    resetParameterValuesChanged();
+    _anyChanged = false;
+}
+
+
+void local::AbsCorrelationModel::bindRange(int n, double const *r, double const *mu, double const *z,
+EvaluationContext &context) const {
+    _precomputeRange(n,r,mu,z,context);
+    context.setBinding(n,r,mu,z);
+}
+
+void local::AbsCorrelationModel::bindRange(int n, double const *r, cosmo::Multipole const *multipole,
+double const *z, EvaluationContext &context) const {
+    _bindRange(n,r,multipole,z,context);
+    context.setBinding(n,r,multipole,z);
+}
+
+void local::AbsCorrelationModel::_precomputeRange(int n, double const *r, double const *mu, double const *z,
+EvaluationContext &context) const {
+    // Calculate the Legendre weights used by most models.
+    std::vector<double> &weights = context.getBuffer(this,LEGENDRE_WEIGHTS);
+    weights.resize(2*n);
+    for(int i = 0; i < n; ++i) {
+        double muSq(mu[i]*mu[i]);
+        weights[i] = (3*muSq - 1)/2.;
+        weights[n+i] = (35*muSq*muSq - 30*muSq + 3)/8.;
+    }
+    _bindRange(n,r,mu,z,context);
+}
+
+void local::AbsCorrelationModel::_bindRange(int n, double const *r, double const *mu, double const *z,
+EvaluationContext &context) const { }
+
+void local::AbsCorrelationModel::_bindRange(int n, double const *r, cosmo::Multipole const *multipole,
+double const *z, EvaluationContext &context) const { }
+
+void local::AbsCorrelationModel::_prepareEvaluation(bool anyChanged) { }
+
+void local::AbsCorrelationModel::_declareLinearParameter(int index) {
+    if(index < 0 || index >= getNParameters()) {
+        throw RuntimeError("AbsCorrelationModel: invalid linear parameter index.");
+    }
+    _linearParameterIndices.push_back(index);
+}
+
+int local::AbsCorrelationModel::_defineTerm(std::vector<int> const &parameterIndices) {
+    for(int k = 0; k < parameterIndices.size(); ++k) {
+        if(parameterIndices[k] < 0 || parameterIndices[k] >= getNParameters()) {
+            throw RuntimeError("AbsCorrelationModel: invalid term parameter index.");
+        }
+    }
+    _termDependencies.push_back(parameterIndices);
+    _termGeneration.push_back(1);
+    return _termDependencies.size() - 1;
+}
+
+void local::AbsCorrelationModel::_evaluateLinearBasis(int n, double const *r, double const *mu,
+double const *z, double *basis, int stride, EvaluationContext &context) const {
+    throw RuntimeError("AbsCorrelationModel: linear basis not implemented for this model.");
+}
+
+void local::AbsCorrelationModel::_evaluateBatch(int n, double const *r, double const *mu, double const *z,
+double *result, EvaluationContext &context) const {
+    for(int i = 0; i < n; ++i) {
+        result[i] = _evaluate(r[i],mu[i],z[i],_anyChanged && 0 == i);
+    }
+}
+
+void local::AbsCorrelationModel::_evaluateBatch(int n, double const *r, cosmo::Multipole const *multipole,
+double const *z, double *result, EvaluationContext &context) const {
+    for(int i = 0; i < n; ++i) {
+        result[i] = _evaluate(r[i],multipole[i],z[i],_anyChanged && 0 == i);
+    }
+}
+
 int local::AbsCorrelationModel::_defineLinearBiasParameters(double zref) {
     if(_indexBase >= 0) throw RuntimeError("AbsCorrelationModel: linear bias parameters already defined.");
     if(zref < 0) throw RuntimeError("AbsCorrelationModel: expected zref >= 0.");
@@ -38,13 +171,78 @@ int local::AbsCorrelationModel::_defineLinearBiasParameters(double zref) {
     defineParameter("(1+beta)*bias",-0.336,0.03);
     // Redshift evolution parameters
     defineParameter("gamma-bias",3.8,0.3);
-    return defineParameter("gamma-beta",0,0.1);
+    int last = defineParameter("gamma-beta",0,0.1);
+    // Our normalization factors depend on all of these parameters.
+    std::vector<int> dependencies;
+    for(int index = _indexBase; index <= last; ++index) dependencies.push_back(index);
+    _redshiftTerm = _defineTerm(dependencies);
+    return last;
+}
+
+int local::AbsCorrelationModel::_defineRedshiftEvolution(int gammaIndex) {
+    if(_redshiftTerm < 0) throw RuntimeError("AbsCorrelationModel: no linear bias parameters defined.");
+    if(gammaIndex < 0 || gammaIndex >= getNParameters()) {
+        throw RuntimeError("AbsCorrelationModel: invalid redshift evolution parameter index.");
+    }
+    _evolutionGammas.push_back(gammaIndex);
+    _termDependencies[_redshiftTerm].push_back(gammaIndex);
+    return BETA_Z + _evolutionGammas.size();
 }
 
 double local::AbsCorrelationModel::_redshiftEvolution(double p0, double gamma, double z) const {
     return p0*std::pow((1+z)/(1+_zref),gamma);
 }
 
+double const *local::AbsCorrelationModel::_getRedshiftFactors(double z, EvaluationContext &context) const {
+    // The cache is laid out as [ generation, last, z[0], factors[0], z[1], factors[1], ... ] where
+    // last is the index of the most recently used entry.
+    if(_redshiftTerm < 0) throw RuntimeError("AbsCorrelationModel: no linear bias parameters defined.");
+    std::vector<double> &cache = context.getBuffer(this,REDSHIFT_CACHE);
+    int stride = 2 + BETA_Z + _evolutionGammas.size();
+    double generation = _getTermGeneration(_redshiftTerm);
+    if(cache.size() < 2 || cache[0] != generation) {
+        cache.assign(2,0);
+        cache[0] = generation;
+    }
+    int nz = (cache.size() - 2)/stride;
+    // Try the most recently used entry first, since consecutive bins usually share a redshift.
+    int last(cache[1]);
+    if(last < nz && cache[2 + last*stride] == z) return &cache[3 + last*stride];
+    for(int index = 0; index < nz; ++index) {
+        if(cache[2 + index*stride] == z) {
+            cache[1] = index;
+            return &cache[3 + index*stride];
+        }
+    }
+    // Add a new entry, starting over if this is not the handful of redshifts we expect from binned data.
+    int const maxRedshifts(64);
+    if(nz == maxRedshifts) nz = 0;
+    cache.resize(2 + (nz+1)*stride);
+    cache[1] = nz;
+    double *entry = &cache[2 + nz*stride];
+    entry[0] = z;
+    double *factors = entry + 1;
+    _getNormFactors(z,factors);
+    double zratio((1+z)/(1+_zref));
+    for(int k = 0; k < _evolutionGammas.size(); ++k) {
+        factors[BETA_Z + 1 + k] = std::pow(zratio,getParameterValue(_evolutionGammas[k]));
+    }
+    return factors;
+}
+
+void local::AbsCorrelationModel::_getNormFactors(double z, double *norms) const {
+    double beta0 = getParameterValue(_indexBase + BETA);
+    double bb0 = getParameterValue(_indexBase + BB);
+    double bias0 = bb0/(1+beta0);
+    double biasSq = _redshiftEvolution(bias0*bias0,getParameterValue(_indexBase + GAMMA_BIAS),z);
+    double beta = _redshiftEvolution(beta0,getParameterValue(_indexBase + GAMMA_BETA),z);
+    norms[NORM0] = biasSq*(1 + beta*(2./3. + (1./5.)*beta));
+    norms[NORM2] = biasSq*beta*(4./3. + (4./7.)*beta);
+    norms[NORM4] = biasSq*beta*beta*(8./35.);
+    norms[BIAS_SQ] = biasSq;
+    norms[BETA_Z] = beta;
+}
+
 double local::AbsCorrelationModel::_getNormFactor(cosmo::Multipole multipole, double z) const {
     if(_indexBase < 0) throw RuntimeError("AbsCorrelationModel: no linear bias parameters defined.");
     // Lookup the linear bias parameters.
@@ -3,6 +3,9 @@
 #ifndef BAOFIT_ABS_CORRELATION_MODEL
 #define BAOFIT_ABS_CORRELATION_MODEL
 
+#include "baofit/types.h"
+#include "baofit/EvaluationContext.h"
+
 #include "likely/FitModel.h"
 
 #include "cosmo/types.h"
@@ -24,16 +27,100 @@ namespace baofit {
         // Returns the correlation function for the specified multipole at co-moving pair separation
         // r and average pair redshift z. Updates our current parameter values.
         double evaluate(double r, cosmo::Multipole multipole, double z, likely::Parameters const &params);
+        // Fills the vector provided with the correlation function evaluated in redshift space at each
+        // (r[i],mu[i],z[i]). The input vectors must all have the same size. Updates our current
+        // parameter values once for the whole batch.
+        void evaluateBatch(std::vector<double> const &r, std::vector<double> const &mu,
+            std::vector<double> const &z, likely::Parameters const &params, std::vector<double> &result);
+        // Fills the vector provided with the correlation function for each multipole[i] at co-moving
+        // pair separation r[i] and average pair redshift z[i]. The input vectors must all have the
+        // same size. Updates our current parameter values once for the whole batch.
+        void evaluateBatch(std::vector<double> const &r, std::vector<cosmo::Multipole> const &multipole,
+            std::vector<double> const &z, likely::Parameters const &params, std::vector<double> &result);
+        // Prepares for one or more calls to evaluateRange() with the specified parameter values.
+        // Each call must be followed by a call to endEvaluation() once all ranges have been
+        // evaluated. These two methods must always be called from a single thread.
+        void beginEvaluation(likely::Parameters const &params);
+        void endEvaluation();
+        // Binds the specified context to the n bins at (r[i],mu[i],z[i]) and precomputes any per-bin
+        // quantities that only depend on these coordinates, so that subsequent calls to evaluateRange()
+        // and evaluateLinearBasis() with the same arrays only need to combine them with the current
+        // parameter values. The arrays must remain valid and unchanged while the context is bound to
+        // them. Evaluating a range with different arrays rebinds its context automatically, so an
+        // explicit call is only required when arrays at the same address might hold new bins.
+        void bindRange(int n, double const *r, double const *mu, double const *z,
+            EvaluationContext &context) const;
+        void bindRange(int n, double const *r, cosmo::Multipole const *multipole, double const *z,
+            EvaluationContext &context) const;
+        // Fills result[0..n-1] using the parameter values provided to beginEvaluation() and the
+        // specified context for any scratch storage. Different threads can evaluate ranges
+        // concurrently, as long as each thread uses a different context.
+        void evaluateRange(int n, double const *r, double const *mu, double const *z,
+            double *result, EvaluationContext &context) const;
+        void evaluateRange(int n, double const *r, cosmo::Multipole const *multipole, double const *z,
+            double *result, EvaluationContext &context) const;
+        // Returns the indices of any parameters that our predictions depend on linearly, in the
+        // order used by evaluateLinearBasis().
+        std::vector<int> const &getLinearParameterIndices() const;
+        // Fills basis[k*stride+i], for i = 0..n-1, with the derivative of the correlation function at
+        // (r[i],mu[i],z[i]) with respect to the k-th linear parameter, using the parameter values
+        // provided to beginEvaluation(). Can be called concurrently, like evaluateRange().
+        void evaluateLinearBasis(int n, double const *r, double const *mu, double const *z,
+            double *basis, int stride, EvaluationContext &context) const;
         // Prints a multi-line description of this object to the specified output stream.
         virtual void printToStream(std::ostream &out, std::string const &formatSpec = "%12.6f") const;
     protected:
         friend class BaoCorrelationModel;
         friend class BroadbandModel;
-        // The public methods above call these protected methods after making parameter values
-        // and changes available via our base class' getParameterValue() and isParameterValueChanged()
-        // methods. Any registered changes to parameter values are reset after calling any of these.
+        // Called from beginEvaluation() after making parameter values and changes available via our
+        // base class' getParameterValue() and isParameterValueChanged() methods. Subclasses should
+        // override this method to update any state shared by all contexts that depends on parameter
+        // values. The default implementation does nothing.
+        virtual void _prepareEvaluation(bool anyChanged);
+        // Called from bindRange() to precompute any per-bin quantities that do not depend on parameter
+        // values and store them in the context provided. The default implementations do nothing.
+        virtual void _bindRange(int n, double const *r, double const *mu, double const *z,
+            EvaluationContext &context) const;
+        virtual void _bindRange(int n, double const *r, cosmo::Multipole const *multipole,
+            double const *z, EvaluationContext &context) const;
+        // Precomputes the per-bin quantities for the n bins at (r[i],mu[i],z[i]) without recording a
+        // binding, for subclasses that evaluate multipoles using internal arrays of coordinates.
+        void _precomputeRange(int n, double const *r, double const *mu, double const *z,
+            EvaluationContext &context) const;
+        // Returns the ell=2 and ell=4 Legendre weights of the mu values bound to the specified context,
+        // stored as L2[0..n-1] followed by L4[0..n-1].
+        double const *_getLegendreWeights(EvaluationContext &context) const;
+        // Single-point evaluation methods that are only called by the default implementations
+        // of _evaluateBatch below.
         virtual double _evaluate(double r, double mu, double z, bool changed) const = 0;
         virtual double _evaluate(double r, cosmo::Multipole multipole, double z, bool changed) const = 0;
+        // Fills result[0..n-1] using the current parameter values. The public methods above call
+        // these protected methods between _prepareEvaluation() and the resetting of any registered
+        // changes to parameter values. Implementations must be re-entrant, keeping any mutable
+        // state in the context provided. The default implementations simply loop over the
+        // single-point methods, passing the changed flag only with the first point, and are not
+        // re-entrant. Subclasses should override these to move per-parameter work out of the
+        // per-bin loop.
+        virtual void _evaluateBatch(int n, double const *r, double const *mu, double const *z,
+            double *result, EvaluationContext &context) const;
+        virtual void _evaluateBatch(int n, double const *r, cosmo::Multipole const *multipole,
+            double const *z, double *result, EvaluationContext &context) const;
+        // Returns the context used by evaluate() and evaluateBatch().
+        EvaluationContext &_getDefaultContext() const;
+        // Declares that our predictions depend linearly on the parameter with the specified index.
+        // Subclasses that declare any linear parameters must implement _evaluateLinearBasis.
+        void _declareLinearParameter(int index);
+        // Implements evaluateLinearBasis(). The default implementation throws an exception.
+        virtual void _evaluateLinearBasis(int n, double const *r, double const *mu, double const *z,
+            double *basis, int stride, EvaluationContext &context) const;
+        // Defines a term of our prediction that only depends on the parameters with the specified
+        // indices, so that its values can be cached between evaluations. Returns the index of the
+        // new term to use with _getTermGeneration().
+        int _defineTerm(std::vector<int> const &parameterIndices);
+        // Returns a positive counter for the specified term that beginEvaluation() increments
+        // whenever the value of any parameter the term depends on has changed. Subclasses can
+        // record this counter in a context to detect when its cached term values are stale.
+        int _getTermGeneration(int term) const;
         // Defines the standard set of linear bias parameters used by _getNormFactor below. Returns
         // the index of the last parameter defined.
         int _defineLinearBiasParameters(double zref);
@@ -42,11 +129,60 @@ namespace baofit {
         double _redshiftEvolution(double p0, double gamma, double z) const;
         // Updates the multipole normalization factors b^2(z)*C_ell(beta(z)) returned by getNormFactor(ell).
         double _getNormFactor(cosmo::Multipole multipole, double z) const;
+        // Declares that the parameter with the specified index is the exponent gamma of a redshift
+        // evolution factor ((1+z)/(1+zref))^gamma that should be cached by _getRedshiftFactors.
+        // Returns the offset of the new factor in the array returned by _getRedshiftFactors.
+        int _defineRedshiftEvolution(int gammaIndex);
+        // Returns an array of the factors that depend only on z and parameter values: the ell=0,2,4
+        // normalization factors at offsets NORM0, NORM2, NORM4, the evolved b^2(z) and beta(z) at
+        // offsets BIAS_SQ and BETA_Z, followed by any evolution factors defined above. Factors are cached for each distinct z in the context provided and only
+        // recalculated after a parameter they depend on has changed. The returned pointer is only
+        // valid until the next call using the same context.
+        double const *_getRedshiftFactors(double z, EvaluationContext &context) const;
+        enum { NORM0 = 0, NORM2 = 1, NORM4 = 2, BIAS_SQ = 3, BETA_Z = 4 };
     private:
+        // Fills norms[0..2] with the ell=0,2,4 values returned by _getNormFactor, followed by
+        // b^2(z) and beta(z).
+        void _getNormFactors(double z, double *norms) const;
         int _indexBase;
         enum IndexOffset { BETA = 0, BB = 1, GAMMA_BIAS = 2, GAMMA_BETA = 3 };
         double _zref;
+        bool _anyChanged;
+        EvaluationContextPtr _defaultContext;
+        std::vector<int> _linearParameterIndices;
+        std::vector<std::vector<int> > _termDependencies;
+        std::vector<int> _termGeneration;
+        // Our redshift factors are cached as a term whose dependencies are the linear bias parameters
+        // and the exponents of each evolution factor. Our context buffers use negative slot numbers
+        // that will not clash with our subclasses.
+        int _redshiftTerm;
+        std::vector<int> _evolutionGammas;
+        enum { REDSHIFT_CACHE = -1, LEGENDRE_WEIGHTS = -2 };
 	}; // AbsCorrelationModel
+	
+    inline void AbsCorrelationModel::evaluateRange(int n, double const *r, double const *mu,
+    double const *z, double *result, EvaluationContext &context) const {
+        if(!context.isBound(n,r,mu,z)) bindRange(n,r,mu,z,context);
+        _evaluateBatch(n,r,mu,z,result,context);
+    }
+    inline void AbsCorrelationModel::evaluateRange(int n, double const *r,
+    cosmo::Multipole const *multipole, double const *z, double *result, EvaluationContext &context) const {
+        if(!context.isBound(n,r,multipole,z)) bindRange(n,r,multipole,z,context);
+        _evaluateBatch(n,r,multipole,z,result,context);
+    }
+    inline EvaluationContext &AbsCorrelationModel::_getDefaultContext() const { return *_defaultContext; }
+    inline double const *AbsCorrelationModel::_getLegendreWeights(EvaluationContext &context) const {
+        return &context.getBuffer(this,LEGENDRE_WEIGHTS)[0];
+    }
+    inline int AbsCorrelationModel::_getTermGeneration(int term) const { return _termGeneration[term]; }
+    inline std::vector<int> const &AbsCorrelationModel::getLinearParameterIndices() const {
+        return _linearParameterIndices;
+    }
+    inline void AbsCorrelationModel::evaluateLinearBasis(int n, double const *r, double const *mu,
+    double const *z, double *basis, int stride, EvaluationContext &context) const {
+        if(!context.isBound(n,r,mu,z)) bindRange(n,r,mu,z,context);
+        _evaluateLinearBasis(n,r,mu,z,basis,stride,context);
+    }
 } // baofit
 
 #endif // BAOFIT_ABS_CORRELATION_MODEL
@@ -3,22 +3,42 @@
 #include "baofit/BaoCorrelationModel.h"
 #include "baofit/RuntimeError.h"
 #include "baofit/BroadbandModel.h"
+#include "baofit/EvaluationContext.h"
+#include "baofit/FitProfile.h"
+#include "baofit/ModelPack.h"
+#include "baofit/PeakBroadening.h"
+#include "baofit/quadrature.h"
 
-#include "likely/Interpolator.h"
 #include "likely/function.h"
 #include "likely/RuntimeError.h"
 
 #include "boost/format.hpp"
 
 #include <cmath>
+#include <algorithm>
+#include <map>
+#include <utility>
 
 namespace local = baofit;
 
+namespace baofit {
+namespace bao {
+    // Number of Gauss-Legendre nodes on [-1,1] used to project multipoles. The projection is
+    // exact for models that are polynomials in mu of degree up to 27, such as the isotropic-scale
+    // Kaiser model, which we check when each model is created. The anisotropic model is not a
+    // polynomial in mu, so its projection is only approximate.
+    int const nQuadrature = 16;
+    // Relative tolerance of the projection self-test.
+    double const projectionTolerance = 1e-12;
+}} // baofit::bao
+
 local::BaoCorrelationModel::BaoCorrelationModel(std::string const &modelrootName,
     std::string const &fiducialName, std::string const &nowigglesName,
     std::string const &distAdd, std::string const &distMul, double distR0,
-    double zref, bool anisotropic, bool decoupled)
-: AbsCorrelationModel("BAO Correlation Model"), _anisotropic(anisotropic), _decoupled(decoupled)
+    double zref, bool anisotropic, bool decoupled, double templateAccuracy,
+    std::string const &modelPackName, bool nonlinearBroadening)
+: AbsCorrelationModel("BAO Correlation Model"), _anisotropic(anisotropic), _decoupled(decoupled),
+_templateAccuracy(templateAccuracy), _broadeningResidual(0)
 {
     // Linear bias parameters
     _indexBase = _defineLinearBiasParameters(zref);
@@ -28,194 +48,436 @@ local::BaoCorrelationModel::BaoCorrelationModel(std::string const &modelrootName
     defineParameter("BAO alpha-parallel",1,0.1);
     defineParameter("BAO alpha-perp",1,0.1);
     defineParameter("gamma-scale",0,0.5);
-    // Load the interpolation data we will use for each multipole of each model.
-    std::string root(modelrootName);
-    if(0 < root.size() && root[root.size()-1] != '/') root += '/';
-    boost::format fileName("%s%s.%d.dat");
-    std::string method("cspline");
+    if(nonlinearBroadening) {
+        // Gaussian damping scales of the BAO peak in Mpc/h, with initial values predicted for
+        // z = 2.3 by Eisenstein, Seo & White (2007), as used by Kirkby et al (2013).
+        defineParameter("BAO Sigma-par",6.41,0.5);
+        defineParameter("BAO Sigma-perp",3.26,0.5);
+    }
+    // Load the interpolation data we will use for each multipole of each model, either from
+    // a precompiled model pack or else from text files.
+    std::string fiducial(fiducialName), nowiggles(nowigglesName);
     try {
-        _fid0 = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(fileName % root % fiducialName % 0),method));
-        _fid2 = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(fileName % root % fiducialName % 2),method));
-        _fid4 = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(fileName % root % fiducialName % 4),method));
-        _nw0 = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(fileName % root % nowigglesName % 0),method));
-        _nw2 = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(fileName % root % nowigglesName % 2),method));
-        _nw4 = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(fileName % root % nowigglesName % 4),method));
+        if(modelPackName.length() > 0) {
+            std::string root(modelrootName);
+            if(0 < root.size() && root[root.size()-1] != '/') root += '/';
+            ModelPack pack(root + modelPackName);
+            if((fiducialName.length() > 0 && fiducialName != pack.getFiducialName()) ||
+            (nowigglesName.length() > 0 && nowigglesName != pack.getNoWigglesName())) {
+                throw RuntimeError("BaoCorrelationModel: model pack was created for different models.");
+            }
+            _templates = pack.getTemplates();
+            _templateAccuracy = pack.getAccuracy();
+            fiducial = pack.getFiducialName();
+            nowiggles = pack.getNoWigglesName();
+        }
+        else {
+            _templates = ModelPack::readTemplates(modelrootName,fiducialName,nowigglesName,templateAccuracy);
+        }
     }
     catch(likely::RuntimeError const &e) {
         throw RuntimeError("BaoCorrelationModel: error while reading model interpolation data.");
     }
+    // Prepare to calculate the broadened BAO peak over the same range as our templates.
+    if(nonlinearBroadening) {
+        _broadening.reset(new PeakBroadening(modelrootName,fiducial,nowiggles,
+            _templates->getXMin(),_templates->getXMax(),_templateAccuracy));
+        // Check that the undamped peak reproduces the peak of our tabulated models, using beta = 1
+        // so that every template contributes, and save the largest difference relative to the
+        // largest peak multipole for printToStream.
+        UniformSplinePtr undamped = _broadening->getTemplates(0,0);
+        double const beta(1), c2(2*beta), c4(beta*beta);
+        double norms[3] = { 1 + beta*(2./3. + (1./5.)*beta), beta*(4./3. + (4./7.)*beta), beta*beta*(8./35.) };
+        int const nCheck(500);
+        double t[NTEMPLATES], T[9], maxPeak(0), maxDiff(0);
+        for(int i = 0; i <= nCheck; ++i) {
+            double r = _templates->getXMin() + (_templates->getXMax() - _templates->getXMin())*i/nCheck;
+            _templates->evaluate(r,t);
+            undamped->evaluate(r,T);
+            for(int ell = 0; ell < 3; ++ell) {
+                double expected = norms[ell]*(t[FID0 + ell] - t[NW0 + ell]);
+                double calculated = T[3*ell] + c2*T[3*ell+1] + c4*T[3*ell+2];
+                if(std::fabs(expected) > maxPeak) maxPeak = std::fabs(expected);
+                if(std::fabs(calculated - expected) > maxDiff) maxDiff = std::fabs(calculated - expected);
+            }
+        }
+        _broadeningResidual = maxPeak > 0 ? maxDiff/maxPeak : 0;
+    }
     // Define our broadband distortion models, if any.
     if(distAdd.length() > 0) {
         _distortAdd.reset(new baofit::BroadbandModel("Additive broadband distortion",
             "dist add",distAdd,distR0,zref,this));
     }
+    _nAddTerms = getLinearParameterIndices().size();
     if(distMul.length() > 0) {
         _distortMul.reset(new baofit::BroadbandModel("Multiplicative broadband distortion",
             "dist mul",distMul,distR0,zref,this));
     }
+    // Declare the parameters that each term of our prediction depends on. The linear bias
+    // parameters precede _indexBase and the BAO amplitude is applied after caching.
+    std::vector<int> bias, scale, add, mul;
+    for(int index = _indexBase - 3; index <= _indexBase; ++index) bias.push_back(index);
+    for(int index = _indexBase + 2; index <= _indexBase + 5; ++index) scale.push_back(index);
+    std::vector<int> const &linear = getLinearParameterIndices();
+    add.assign(linear.begin(),linear.begin() + _nAddTerms);
+    add.push_back(_indexBase - 1); // gamma-bias
+    mul.assign(linear.begin() + _nAddTerms,linear.end());
+    std::vector<int> scaled(bias);
+    scaled.insert(scaled.end(),scale.begin(),scale.end());
+    std::vector<int> peak(scaled);
+    if(_broadening) {
+        peak.push_back(_indexBase + 6); // Sigma-par
+        peak.push_back(_indexBase + 7); // Sigma-perp
+    }
+    _terms[PEAK] = _defineTerm(peak);
+    _terms[SMOOTH] = _defineTerm(_decoupled ? bias : scaled);
+    _terms[ADD] = _defineTerm(add);
+    _terms[MUL] = _defineTerm(mul);
+    // Cache the redshift evolution of the BAO scales and of the additive distortion.
+    _scaleEvolution = _defineRedshiftEvolution(_indexBase + 5); // gamma-scale
+    _biasEvolution = _defineRedshiftEvolution(_indexBase - 1); // gamma-bias
+    // Tabulate the quadrature used to project multipoles, including the (2ell+1)/2 normalization.
+    std::vector<double> weights;
+    getGaussLegendreRule(bao::nQuadrature,-1,1,_muNodes,weights);
+    _projection.resize(3*bao::nQuadrature);
+    for(int k = 0; k < bao::nQuadrature; ++k) {
+        double muSq(_muNodes[k]*_muNodes[k]);
+        _projection[k] = weights[k]/2;
+        _projection[bao::nQuadrature+k] = (5./2.)*weights[k]*(3*muSq - 1)/2.;
+        _projection[2*bao::nQuadrature+k] = (9./2.)*weights[k]*(35*muSq*muSq - 30*muSq + 3)/8.;
+    }
+    // Check that we reproduce the exact multipoles of the Kaiser factor (1 + beta mu^2)^2.
+    double const beta(1.4);
+    double exact[3] = { 1 + beta*(2./3. + (1./5.)*beta), beta*(4./3. + (4./7.)*beta), beta*beta*(8./35.) };
+    for(int ell = 0; ell < 3; ++ell) {
+        double projected(0);
+        for(int k = 0; k < bao::nQuadrature; ++k) {
+            double kaiser(1 + beta*_muNodes[k]*_muNodes[k]);
+            projected += _projection[ell*bao::nQuadrature+k]*kaiser*kaiser;
+        }
+        if(!(std::fabs(projected - exact[ell]) <= bao::projectionTolerance*exact[0])) {
+            throw RuntimeError("BaoCorrelationModel: multipole projection failed its self-test.");
+        }
+    }
 }
 
 local::BaoCorrelationModel::~BaoCorrelationModel() { }
 
 double local::BaoCorrelationModel::_evaluate(double r, double mu, double z, bool anyChanged) const {
+    double result;
+    bindRange(1,&r,&mu,&z,_getDefaultContext());
+    _evaluateBatch(1,&r,&mu,&z,&result,_getDefaultContext());
+    return result;
+}
 
-    // Lookup parameter values by name.
-    double ampl = getParameterValue(_indexBase + 1); //("BAO amplitude");
-    double scale = getParameterValue(_indexBase + 2); //"BAO alpha-iso");
-    double scale_parallel = getParameterValue(_indexBase + 3); //("BAO alpha-parallel");
-    double scale_perp = getParameterValue(_indexBase + 4); //("BAO alpha-perp");
-    double gamma_scale = getParameterValue(_indexBase + 5); //("gamma-scale");
-
-    // Calculate redshift evolution of the scale parameters.
-    scale = _redshiftEvolution(scale,gamma_scale,z);
-    scale_parallel = _redshiftEvolution(scale_parallel,gamma_scale,z);
-    scale_perp = _redshiftEvolution(scale_perp,gamma_scale,z);
-
-    // Transform (r,mu) to (rBAO,muBAO) using the scale parameters.
-    double rBAO, muBAO;
-    if(_anisotropic) {
-        double ap1(scale_parallel);
-        double bp1(scale_perp);
-        double musq(mu*mu);
-        // Exact (r,mu) transformation
-        double rscale = std::sqrt(ap1*ap1*musq + (1-musq)*bp1*bp1);
-        rBAO = r*rscale;
-        muBAO = mu*ap1/rscale;
-        // Linear approximation, equivalent to multipole model below
-        /*
-        rBAO = r*(1 + (ap1-1)*musq + (bp1-1)*(1-musq));
-        muBAO = mu*(1 + (ap1-bp1)*(1-musq));
-        */
-    }
-    else {
-        rBAO = r*scale;
-        muBAO = mu;
-    }
-
-    // Calculate the cosmological prediction.
-    double norm0 = _getNormFactor(cosmo::Monopole,z), norm2 = _getNormFactor(cosmo::Quadrupole,z),
-        norm4 = _getNormFactor(cosmo::Hexadecapole,z);
-    double musq(muBAO*muBAO);
-    double L2 = (-1+3*musq)/2., L4 = (3+musq*(-30+35*musq))/8.;
-    double fid = norm0*(*_fid0)(rBAO) + norm2*L2*(*_fid2)(rBAO) + norm4*L4*(*_fid4)(rBAO);
-    double nw = norm0*(*_nw0)(rBAO) + norm2*L2*(*_nw2)(rBAO) + norm4*L4*(*_nw4)(rBAO);
-    double peak = ampl*(fid-nw);
-    double smooth = nw;
+void local::BaoCorrelationModel::_bindRange(int n, double const *r, double const *mu, double const *z,
+EvaluationContext &context) const {
+    // Generations start at one, so this marks every cached term as stale.
+    context.getBuffer(this,BUILT).assign(NTERMS,0);
+    for(int term = 0; term < NTERMS; ++term) context.getBuffer(this,term).resize(n);
+    // The decoupled smooth term only depends on parameters through its normalization.
     if(_decoupled) {
-        // Recalculate the smooth cosmological prediction using (r,mu) instead of (rBAO,muBAO)
-        double musq(mu*mu);
-        double L2 = (-1+3*musq)/2., L4 = (3+musq*(-30+35*musq))/8.;
-        smooth = norm0*(*_nw0)(r) + norm2*L2*(*_nw2)(r) + norm4*L4*(*_nw4)(r);
-    }
-    double xi = peak + smooth;
-    
-    // Add broadband distortions, if any.
-    if(_distortMul) xi *= 1 + _distortMul->_evaluate(r,mu,z,anyChanged);
+        if(n > 0) _checkRange(*std::min_element(r,r+n),*std::max_element(r,r+n));
+        std::vector<double> &decoupled = context.getBuffer(this,DECOUPLED);
+        decoupled.resize(3*n);
+        double const *L2 = _getLegendreWeights(context), *L4 = L2 + n;
+        double t[NTEMPLATES];
+        for(int i = 0; i < n; ++i) {
+            _templates->evaluate(r[i],t);
+            decoupled[i] = t[NW0];
+            decoupled[n+i] = L2[i]*t[NW2];
+            decoupled[2*n+i] = L4[i]*t[NW4];
+        }
+    }
+    if(_distortMul) _distortMul->_bindRange(n,r,mu,z,context);
+    if(_distortAdd) _distortAdd->_bindRange(n,r,mu,z,context);
+}
+
+void local::BaoCorrelationModel::_prepareEvaluation(bool anyChanged) {
+    // Lookup the broadened peak templates here, since evaluations can run in parallel threads.
+    if(_broadening && (anyChanged || !_broadened)) {
+        _broadened = _broadening->getTemplates(getParameterValue(_indexBase + 6),
+            getParameterValue(_indexBase + 7));
+    }
+    if(_distortMul) _distortMul->_prepareEvaluation(anyChanged);
+    if(_distortAdd) _distortAdd->_prepareEvaluation(anyChanged);
+}
+
+void local::BaoCorrelationModel::_evaluateCosmology(int n, double const *r, double const *mu,
+double const *z, double *peak, double *smooth, EvaluationContext &context) const {
+
+    // Lookup our tabulated models.
+    UniformSpline const &templates = *_templates;
+    double t[NTEMPLATES];
+
+    // Lookup parameter values by index once for the whole batch.
+    double scale0 = getParameterValue(_indexBase + 2); //"BAO alpha-iso");
+    double scale_parallel0 = getParameterValue(_indexBase + 3); //("BAO alpha-parallel");
+    double scale_perp0 = getParameterValue(_indexBase + 4); //("BAO alpha-perp");
+
+    // Do we need the no-wiggles model at the scaled separation?
+    bool scaledSmooth(smooth && !_decoupled);
+
+    // Do we calculate the peak from the broadened templates?
+    UniformSpline const *broadened = (peak && _broadening) ? _broadened.get() : 0;
+    double T[9];
+
+    // Lookup the per-bin quantities precomputed by _bindRange.
+    double const *L2mu = _getLegendreWeights(context), *L4mu = L2mu + n;
+    double const *decoupled = (smooth && _decoupled) ? &context.getBuffer(this,DECOUPLED)[0] : 0;
+
+    // Track the range of scaled separations so that we can check it once for the whole batch.
+    double rBAOmin(0), rBAOmax(0);
+
+    for(int i = 0; i < n; ++i) {
+        double ri(r[i]), mui(mu[i]), zi(z[i]);
+        double const *factors = _getRedshiftFactors(zi,context);
+        double norm0 = factors[NORM0], norm2 = factors[NORM2], norm4 = factors[NORM4];
+
+        if(peak || scaledSmooth) {
+            // Calculate redshift evolution of the scale parameters.
+            double evolution = factors[_scaleEvolution];
+            double scale = scale0*evolution;
+            double scale_parallel = scale_parallel0*evolution;
+            double scale_perp = scale_perp0*evolution;
+
+            // Transform (r,mu) to (rBAO,muBAO) using the scale parameters.
+            double rBAO, L2, L4;
+            if(_anisotropic) {
+                double ap1(scale_parallel);
+                double bp1(scale_perp);
+                double musq(mui*mui);
+                // Exact (r,mu) transformation
+                double rscale = std::sqrt(ap1*ap1*musq + (1-musq)*bp1*bp1);
+                rBAO = ri*rscale;
+                double muBAO = mui*ap1/rscale;
+                // Linear approximation, equivalent to multipole model below
+                /*
+                rBAO = ri*(1 + (ap1-1)*musq + (bp1-1)*(1-musq));
+                muBAO = mui*(1 + (ap1-bp1)*(1-musq));
+                */
+                double musqBAO(muBAO*muBAO);
+                L2 = (-1+3*musqBAO)/2.;
+                L4 = (3+musqBAO*(-30+35*musqBAO))/8.;
+            }
+            else {
+                // The isotropic scale leaves mu, and therefore its Legendre weights, unchanged.
+                rBAO = ri*scale;
+                L2 = L2mu[i];
+                L4 = L4mu[i];
+            }
+
+            if(0 == i || rBAO < rBAOmin) rBAOmin = rBAO;
+            if(0 == i || rBAO > rBAOmax) rBAOmax = rBAO;
+
+            // Calculate the cosmological prediction.
+            templates.evaluate(rBAO,t);
+            double nw = norm0*t[NW0] + norm2*L2*t[NW2] + norm4*L4*t[NW4];
+            if(broadened) {
+                // Combine the beta-independent templates T(n,ell) stored at 3*(ell/2) + n/2.
+                broadened->evaluate(rBAO,T);
+                double beta(factors[BETA_Z]), c2(2*beta), c4(beta*beta);
+                double peak0 = T[0] + c2*T[1] + c4*T[2];
+                double peak2 = T[3] + c2*T[4] + c4*T[5];
+                double peak4 = T[6] + c2*T[7] + c4*T[8];
+                peak[i] = factors[BIAS_SQ]*(peak0 + L2*peak2 + L4*peak4);
+            }
+            else if(peak) {
+                double fid = norm0*t[FID0] + norm2*L2*t[FID2] + norm4*L4*t[FID4];
+                peak[i] = fid - nw;
+            }
+            if(scaledSmooth) smooth[i] = nw;
+        }
+        if(decoupled) {
+            // Calculate the smooth cosmological prediction using (r,mu) instead of (rBAO,muBAO)
+            smooth[i] = norm0*decoupled[i] + norm2*decoupled[n+i] + norm4*decoupled[2*n+i];
+        }
+    }
+    // Our templates clamp their argument, so reject any predictions that relied on that.
+    if(n > 0 && (peak || scaledSmooth)) _checkRange(rBAOmin,rBAOmax);
+}
+
+void local::BaoCorrelationModel::_checkRange(double rmin, double rmax) const {
+    if(!(rmin >= _templates->getXMin() && rmax <= _templates->getXMax())) {
+        throw RuntimeError(boost::str(boost::format(
+            "BaoCorrelationModel: separations [%g,%g] Mpc/h are outside the tabulated range [%g,%g] Mpc/h.")
+            % rmin % rmax % _templates->getXMin() % _templates->getXMax()));
+    }
+}
+
+void local::BaoCorrelationModel::_updateTerms(int n, double const *r, double const *mu, double const *z,
+EvaluationContext &context, FitProfile *profile) const {
+    // Our cached terms are sized and invalidated by _bindRange.
+    std::vector<double> &built = context.getBuffer(this,BUILT);
+    // Recalculate the cosmological terms if necessary, sharing interpolations where possible.
+    double start(0);
+    bool peakStale(built[PEAK] != _getTermGeneration(_terms[PEAK]));
+    bool smoothStale(built[SMOOTH] != _getTermGeneration(_terms[SMOOTH]));
+    if(peakStale || smoothStale) {
+        if(profile) start = FitProfile::getWallTime();
+        _evaluateCosmology(n,r,mu,z,
+            peakStale ? &context.getBuffer(this,PEAK)[0] : 0,
+            smoothStale ? &context.getBuffer(this,SMOOTH)[0] : 0,context);
+        built[PEAK] = _getTermGeneration(_terms[PEAK]);
+        built[SMOOTH] = _getTermGeneration(_terms[SMOOTH]);
+        if(profile) profile->addTerm("cosmology",false,FitProfile::getWallTime() - start);
+    }
+    else if(profile) profile->addTerm("cosmology",true);
+    // Recalculate the broadband distortions, if any and if necessary.
+    if(_distortMul) {
+        if(built[MUL] != _getTermGeneration(_terms[MUL])) {
+            if(profile) start = FitProfile::getWallTime();
+            _distortMul->_evaluateBatch(n,r,mu,z,&context.getBuffer(this,MUL)[0],context);
+            built[MUL] = _getTermGeneration(_terms[MUL]);
+            if(profile) profile->addTerm("mul-broadband",false,FitProfile::getWallTime() - start);
+        }
+        else if(profile) profile->addTerm("mul-broadband",true);
+    }
     if(_distortAdd) {
-        double distortion = _distortAdd->_evaluate(r,mu,z,anyChanged);
-        // The additive distortion is multiplied by ((1+z)/(1+z0))^gamma_bias
-        double gamma_bias = getParameterValue(_indexBase - 1); //("gamma-bias");
-        xi += _redshiftEvolution(distortion,gamma_bias,z);
+        if(built[ADD] != _getTermGeneration(_terms[ADD])) {
+            if(profile) start = FitProfile::getWallTime();
+            double *add = &context.getBuffer(this,ADD)[0];
+            _distortAdd->_evaluateBatch(n,r,mu,z,add,context);
+            // The additive distortion is multiplied by ((1+z)/(1+z0))^gamma_bias
+            for(int i = 0; i < n; ++i) add[i] *= _getRedshiftFactors(z[i],context)[_biasEvolution];
+            built[ADD] = _getTermGeneration(_terms[ADD]);
+            if(profile) profile->addTerm("add-broadband",false,FitProfile::getWallTime() - start);
+        }
+        else if(profile) profile->addTerm("add-broadband",true);
+    }
+}
+
+void local::BaoCorrelationModel::_evaluateBatch(int n, double const *r, double const *mu, double const *z,
+double *result, EvaluationContext &context) const {
+    if(n <= 0) return;
+    _updateTerms(n,r,mu,z,context,context.getProfile());
+
+    // Combine the cached terms.
+    double ampl = getParameterValue(_indexBase + 1); //("BAO amplitude");
+    double const *peak = &context.getBuffer(this,PEAK)[0];
+    double const *smooth = &context.getBuffer(this,SMOOTH)[0];
+    for(int i = 0; i < n; ++i) result[i] = ampl*peak[i] + smooth[i];
+    if(_distortMul) {
+        double const *mul = &context.getBuffer(this,MUL)[0];
+        for(int i = 0; i < n; ++i) result[i] *= 1 + mul[i];
+    }
+    if(_distortAdd) {
+        double const *add = &context.getBuffer(this,ADD)[0];
+        for(int i = 0; i < n; ++i) result[i] += add[i];
     }
+}
 
-    return xi;
+void local::BaoCorrelationModel::_evaluateLinearBasis(int n, double const *r, double const *mu,
+double const *z, double *basis, int stride, EvaluationContext &context) const {
+    if(n <= 0) return;
+    if(_distortAdd) {
+        // The additive distortion is multiplied by ((1+z)/(1+z0))^gamma_bias
+        _distortAdd->_evaluateLinearBasis(n,r,mu,z,basis,stride,context);
+        for(int i = 0; i < n; ++i) {
+            double evolution = _getRedshiftFactors(z[i],context)[_biasEvolution];
+            for(int k = 0; k < _nAddTerms; ++k) basis[k*stride + i] *= evolution;
+        }
+    }
+    if(_distortMul) {
+        // The multiplicative distortion is multiplied by the undistorted cosmological prediction.
+        int nMulTerms = getLinearParameterIndices().size() - _nAddTerms;
+        double *mulBasis = basis + _nAddTerms*stride;
+        _distortMul->_evaluateLinearBasis(n,r,mu,z,mulBasis,stride,context);
+        _updateTerms(n,r,mu,z,context,0);
+        double ampl = getParameterValue(_indexBase + 1); //("BAO amplitude");
+        double const *peak = &context.getBuffer(this,PEAK)[0];
+        double const *smooth = &context.getBuffer(this,SMOOTH)[0];
+        for(int i = 0; i < n; ++i) {
+            double cosmology = ampl*peak[i] + smooth[i];
+            for(int k = 0; k < nMulTerms; ++k) mulBasis[k*stride + i] *= cosmology;
+        }
+    }
 }
 
 double local::BaoCorrelationModel::_evaluate(double r, cosmo::Multipole multipole, double z,
 bool anyChanged) const {
-    /**
-    double beta = getParameterValue("beta");
-    double bb = getParameterValue("(1+beta)*bias");
-    double gamma_bias = getParameterValue("gamma-bias");
-    double gamma_beta = getParameterValue("gamma-beta");
-    double ampl = getParameterValue("BAO amplitude");
-    double scale = getParameterValue("BAO alpha-iso");
-    double scale_parallel = getParameterValue("BAO alpha-parallel");
-    double scale_perp = getParameterValue("BAO alpha-perp");
-    double gamma_scale = getParameterValue("gamma-scale");
-    // Calculate bias(zref) from beta(zref) and bb(zref).
-    double bias = bb/(1+beta);
-    // Calculate redshift evolution.
-    double zratio((1+z)/(1+_zref));
-    double zfactor = std::pow(zratio,gamma_bias);
-    double scaleFactor = std::pow(zratio,gamma_scale);
-    scale *= scaleFactor;
-    scale_parallel *= scaleFactor;
-    scale_perp *= scaleFactor;
-    beta *= std::pow(zratio,gamma_beta);
-    // Calculate the redshift-space distortion scale factor for this multipole.
-    double rsdScale, bband2, rsq(r*r);
-    if(multipole == cosmo::Hexadecapole) {
-        rsdScale = (8./35.)*beta*beta;
-        bband2 = getParameterValue("BBand2 hexa const") + getParameterValue("BBand2 hexa 1/r")/r
-            + getParameterValue("BBand2 hexa 1/(r*r)")/(r*r);
-    }
-    else if(multipole == cosmo::Quadrupole) {
-        rsdScale = 4*beta*((1./3.) + beta/7.);
-        bband2 = getParameterValue("BBand2 quad const") + getParameterValue("BBand2 quad 1/r")/r
-            + getParameterValue("BBand2 quad 1/(r*r)")/(r*r);
-    }
-    else {
-        rsdScale = 1 + beta*((2./3.) + beta/5.);
-        bband2 = getParameterValue("BBand2 mono const") + getParameterValue("BBand2 mono 1/r")/r
-            + getParameterValue("BBand2 mono 1/(r*r)")/(r*r);
-    }
-    // Calculate the peak contribution with scaled radius.
-    double cosmo(0);
-    if(ampl != 0) {
-        double fid, nw;
-        if(_anisotropic) {
-            double fid0 = (*_fid)(r,cosmo::Monopole), fid2 = (*_fid)(r,cosmo::Quadrupole), fid4 = (*_fid)(r,cosmo::Hexadecapole);
-            double nw0 = (*_nw)(r,cosmo::Monopole), nw2 = (*_nw)(r,cosmo::Quadrupole), nw4 = (*_nw)(r,cosmo::Hexadecapole);
-
-            double dr = 1;
-            double fid0p = ((*_fid)(r+dr,cosmo::Monopole) - (*_fid)(r-dr,cosmo::Monopole))/(2*dr);
-            double fid2p = ((*_fid)(r+dr,cosmo::Quadrupole) - (*_fid)(r-dr,cosmo::Quadrupole))/(2*dr);
-            double fid4p = ((*_fid)(r+dr,cosmo::Hexadecapole) - (*_fid)(r-dr,cosmo::Hexadecapole))/(2*dr);
-            double nw0p = ((*_nw)(r+dr,cosmo::Monopole) - (*_nw)(r-dr,cosmo::Monopole))/(2*dr);
-            double nw2p = ((*_nw)(r+dr,cosmo::Quadrupole) - (*_nw)(r-dr,cosmo::Quadrupole))/(2*dr);
-            double nw4p = ((*_nw)(r+dr,cosmo::Hexadecapole) - (*_nw)(r-dr,cosmo::Hexadecapole))/(2*dr);
-        
-            double a(scale_parallel-1);
-            double b(scale_perp-1);
-
-            // !! TODO: add hexadecapole terms below
-            switch(multipole) {
-            case cosmo::Monopole:
-                fid = fid0 + (2./5.)*(a-b)*fid2 + (a+2*b)/3*r*fid0p + (2./15.)*(a-b)*r*fid2p;
-                nw = nw0 + (2./5.)*(a-b)*nw2 + (a+2*b)/3*r*nw0p + (2./15.)*(a-b)*r*nw2p;
-                break;
-            case cosmo::Quadrupole:
-                fid = fid2*(1 + (2./7.)*(a-b)) + (2./3.)*(a-b)*r*fid0p + (11*a+10*b)/21*r*fid2p;
-                nw = nw2*(1 + (2./7.)*(a-b)) + (2./3.)*(a-b)*r*nw0p + (11*a+10*b)/21*r*nw2p;
-                break;
-            case cosmo::Hexadecapole:
-                //throw RuntimeError("BaoCorrelationModel: anisotropic hexadecapole not implemented yet.");
-                fid = nw = 0;
-                break;
-            }
+    double result;
+    bindRange(1,&r,&multipole,&z,_getDefaultContext());
+    _evaluateBatch(1,&r,&multipole,&z,&result,_getDefaultContext());
+    return result;
+}
+
+void local::BaoCorrelationModel::_bindRange(int n, double const *r, cosmo::Multipole const *multipole,
+double const *z, EvaluationContext &context) const {
+    // Find the distinct (r,z) values, which are usually shared by three multipoles.
+    std::map<std::pair<double,double>,int> distinct;
+    std::vector<double> &index = context.getBuffer(this,MP_INDEX);
+    index.resize(n);
+    std::vector<double> rDistinct, zDistinct;
+    for(int i = 0; i < n; ++i) {
+        if(multipole[i] != cosmo::Monopole && multipole[i] != cosmo::Quadrupole &&
+        multipole[i] != cosmo::Hexadecapole) {
+            throw RuntimeError("BaoCorrelationModel: only multipoles ell = 0,2,4 are supported.");
         }
-        else {
-            fid = (*_fid)(r*scale,multipole);
-            nw = (*_nw)(r*scale,multipole);
+        std::pair<std::map<std::pair<double,double>,int>::iterator,bool> found =
+            distinct.insert(std::make_pair(std::make_pair(r[i],z[i]),(int)rDistinct.size()));
+        if(found.second) {
+            rDistinct.push_back(r[i]);
+            zDistinct.push_back(z[i]);
         }
-        peak = ampl*(fid-nw);
+        index[i] = found.first->second;
     }
-    // Combine the peak and broadband components, with bias and redshift evolution.
-    return cosmo + bias*bias*zfactor*rsdScale*bband2;
-    **/
-    throw RuntimeError("BaoCorrelationModel: multipole evaluation temporarily disabled.");
-    return 0;
+    // Build the quadrature points, with the nodes for each (r,z) stored contiguously.
+    int nPoints(bao::nQuadrature*rDistinct.size());
+    std::vector<double> &points = context.getBuffer(this,MP_POINTS);
+    points.resize(3*nPoints);
+    for(int d = 0; d < rDistinct.size(); ++d) {
+        for(int k = 0; k < bao::nQuadrature; ++k) {
+            int point = d*bao::nQuadrature + k;
+            points[point] = rDistinct[d];
+            points[nPoints + point] = _muNodes[k];
+            points[2*nPoints + point] = zDistinct[d];
+        }
+    }
+    context.getBuffer(this,MP_VALUES).resize(nPoints + 3*rDistinct.size());
+    // Precompute everything needed to evaluate our (r,mu) model at these points.
+    _precomputeRange(nPoints,&points[0],&points[nPoints],&points[2*nPoints],context);
+}
+
+void local::BaoCorrelationModel::_evaluateBatch(int n, double const *r, cosmo::Multipole const *multipole,
+double const *z, double *result, EvaluationContext &context) const {
+    if(n <= 0) return;
+    // Evaluate our (r,mu) model at every quadrature point prepared by _bindRange.
+    std::vector<double> const &points = context.getBuffer(this,MP_POINTS);
+    int nPoints(points.size()/3), nDistinct(nPoints/bao::nQuadrature);
+    double *values = &context.getBuffer(this,MP_VALUES)[0];
+    _evaluateBatch(nPoints,&points[0],&points[nPoints],&points[2*nPoints],values,context);
+    // Project all three multipoles at each distinct (r,z) in one pass over its nodes.
+    double *projected = values + nPoints;
+    double const *L0 = &_projection[0], *L2 = L0 + bao::nQuadrature, *L4 = L2 + bao::nQuadrature;
+    for(int d = 0; d < nDistinct; ++d) {
+        double const *v = values + d*bao::nQuadrature;
+        double xi0(0), xi2(0), xi4(0);
+        for(int k = 0; k < bao::nQuadrature; ++k) {
+            xi0 += L0[k]*v[k];
+            xi2 += L2[k]*v[k];
+            xi4 += L4[k]*v[k];
+        }
+        projected[3*d] = xi0;
+        projected[3*d+1] = xi2;
+        projected[3*d+2] = xi4;
+    }
+    // The projections for ell = 0,2,4 are stored at offsets ell/2.
+    double const *index = &context.getBuffer(this,MP_INDEX)[0];
+    for(int i = 0; i < n; ++i) result[i] = projected[3*(int)index[i] + multipole[i]/2];
 }
 
 void  local::BaoCorrelationModel::printToStream(std::ostream &out, std::string const &formatSpec) const {
     AbsCorrelationModel::printToStream(out,formatSpec);
     out << "Using " << (_anisotropic ? "anisotropic":"isotropic") << " BAO scales." << std::endl;
     out << "Scales apply to BAO peak " << (_decoupled ? "only." : "and cosmological broadband.") << std::endl;
+    out << boost::format("Templates use %d uniform points on [%g,%g] with max error %.2g (target %.2g).")
+        % _templates->getNPoints() % _templates->getXMin() % _templates->getXMax()
+        % _templates->getMaxError() % _templateAccuracy << std::endl;
+    if(_broadening) {
+        out << boost::format("BAO peak uses nonlinear broadening (%d templates calculated, %d cached).")
+            % _broadening->getNCalculated() % _broadening->getNCached() << std::endl;
+        out << boost::format("Undamped broadening reproduces the tabulated peak to %.2g of its peak value.")
+            % _broadeningResidual << std::endl;
+    }
 }
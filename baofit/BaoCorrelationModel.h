@@ -4,11 +4,13 @@
 #define BAOFIT_BAO_CORRELATION_MODEL
 
 #include "baofit/AbsCorrelationModel.h"
+#include "baofit/UniformSpline.h"
 #include "baofit/types.h"
 
 #include "cosmo/types.h"
 
 #include <string>
+#include <vector>
 
 namespace baofit {
 	// Represents a two-point correlation model parameterized in terms of the relative scale and amplitude
@@ -16,11 +18,17 @@ namespace baofit {
 	class BaoCorrelationModel : public AbsCorrelationModel {
 	public:
 	    // Creates a new model using the specified tabulated correlation functions at the specified
-	    // reference redshift.
+	    // reference redshift. The tabulated functions are resampled onto uniform grids that
+	    // reproduce their cubic spline interpolation to within templateAccuracy of their peak value,
+	    // unless a model pack is specified, in which case its precomputed tables are used instead.
+	    // With nonlinear broadening, the BAO peak is instead calculated from the fiducial and
+	    // no-wiggles power spectra with a Gaussian damping whose scales are fit parameters.
 		BaoCorrelationModel(std::string const &modelrootName,
 		    std::string const &fiducialName, std::string const &nowigglesName,
             std::string const &distAdd, std::string const &distMul, double distR0,
-            double zref, bool anisotropic = false, bool decoupled = false);
+            double zref, bool anisotropic = false, bool decoupled = false,
+            double templateAccuracy = 1e-6, std::string const &modelPackName = "",
+            bool nonlinearBroadening = false);
 		virtual ~BaoCorrelationModel();
         // Prints a multi-line description of this object to the specified output stream.
         virtual void printToStream(std::ostream &out, std::string const &formatSpec = "%12.6f") const;
@@ -30,13 +38,76 @@ namespace baofit {
 		// be provided in Mpc/h.
         virtual double _evaluate(double r, double mu, double z, bool anyChanged) const;
         // Returns the correlation function for the specified multipole at co-moving pair separation
-        // r and average pair redshift z.
+        // r and average pair redshift z, obtained by projecting the (r,mu) model onto this multipole.
         virtual double _evaluate(double r, cosmo::Multipole multipole, double z, bool anyChanged) const;
+        // Prepares our broadened peak templates and broadband distortion models, if any.
+        virtual void _prepareEvaluation(bool anyChanged);
+        // Invalidates the terms cached in the context provided and precomputes the decoupled smooth
+        // term, if any, and the per-bin quantities of our broadband distortion models.
+        virtual void _bindRange(int n, double const *r, double const *mu, double const *z,
+            EvaluationContext &context) const;
+        // Prepares the (r,mu,z) quadrature points needed to project each distinct (r,z) of the
+        // multipole bins provided.
+        virtual void _bindRange(int n, double const *r, cosmo::Multipole const *multipole,
+            double const *z, EvaluationContext &context) const;
+        // Fills result[0..n-1] with the correlation function evaluated at each (r[i],mu[i],z[i]).
+        virtual void _evaluateBatch(int n, double const *r, double const *mu, double const *z,
+            double *result, EvaluationContext &context) const;
+        // Fills result[0..n-1] with the correlation function multipoles, projected from the (r,mu)
+        // model using a Gauss-Legendre rule in mu. The ell = 0,2,4 multipoles at the same (r,z) are
+        // all calculated together from a single set of (r,mu) evaluations.
+        virtual void _evaluateBatch(int n, double const *r, cosmo::Multipole const *multipole,
+            double const *z, double *result, EvaluationContext &context) const;
+        // Fills basis[k*stride+i] with the derivative of the correlation function at (r[i],mu[i],z[i])
+        // with respect to the k-th broadband distortion coefficient (additive then multiplicative).
+        virtual void _evaluateLinearBasis(int n, double const *r, double const *mu, double const *z,
+            double *basis, int stride, EvaluationContext &context) const;
 	private:
+        // Fills peak[0..n-1] with the BAO peak contribution per unit amplitude and smooth[0..n-1]
+        // with the smooth cosmological contribution, before any broadband distortions are applied.
+        // Either output can be null if it is not needed.
+        void _evaluateCosmology(int n, double const *r, double const *mu, double const *z,
+            double *peak, double *smooth, EvaluationContext &context) const;
+        // Throws a RuntimeError if [rmin,rmax] is not covered by our tabulated templates.
+        void _checkRange(double rmin, double rmax) const;
+        // Makes sure that the per-bin values of each term cached in the specified context are
+        // up to date for the bins it is bound to, only recomputing terms whose parameters have
+        // changed. Records statistics for each term in the profile provided, unless it is null.
+        void _updateTerms(int n, double const *r, double const *mu, double const *z,
+            EvaluationContext &context, FitProfile *profile) const;
         AbsCorrelationModelPtr _distortAdd, _distortMul;
         bool _anisotropic, _decoupled;
-        int _indexBase;
-        cosmo::CorrelationFunctionPtr _fid0, _fid2, _fid4, _nw0, _nw2, _nw4;
+        int _indexBase, _nAddTerms;
+        // Tabulated multipoles of the fiducial (0,1,2) and no-wiggles (3,4,5) models, interpolated
+        // on a shared grid so that one lookup returns all of them. This is never modified after
+        // construction so it is safely shared by all contexts.
+        enum { FID0 = 0, FID2 = 1, FID4 = 2, NW0 = 3, NW2 = 4, NW4 = 5, NTEMPLATES = 6 };
+        UniformSplinePtr _templates;
+        double _templateAccuracy;
+        // With nonlinear broadening, the BAO peak is calculated from the templates returned by
+        // _broadening for the current damping scales, which are only updated by _prepareEvaluation.
+        PeakBroadeningPtr _broadening;
+        UniformSplinePtr _broadened;
+        // Largest difference between the undamped broadened peak and the tabulated peak, relative
+        // to the tabulated peak value, calculated when we are created.
+        double _broadeningResidual;
+        // Our prediction is ampl*peak + smooth, modified by the multiplicative and additive
+        // distortions. Each term is cached per bin in the context buffer with the same index,
+        // and the generation of each cached term is stored in the BUILT buffer. With a decoupled
+        // smooth term, the DECOUPLED buffer holds nw0(r), L2(mu)*nw2(r) and L4(mu)*nw4(r) for each
+        // bound bin, in three consecutive blocks.
+        enum { PEAK = 0, SMOOTH = 1, ADD = 2, MUL = 3, NTERMS = 4, BUILT = 4, DECOUPLED = 5 };
+        // Multipoles are projected from evaluations at a fixed set of mu nodes. A context bound to
+        // multipole bins holds the r, mu and z values of each quadrature point in three consecutive
+        // blocks of the MP_POINTS buffer, the index of the distinct (r,z) of each bin in MP_INDEX,
+        // and scratch space for the model values and projections in MP_VALUES.
+        enum { MP_POINTS = 6, MP_INDEX = 7, MP_VALUES = 8 };
+        // The weight of node k in the projection onto multipole ell = 0,2,4 is stored in
+        // _projection[(ell/2)*nNodes+k].
+        std::vector<double> _muNodes, _projection;
+        int _terms[NTERMS];
+        // Offsets of our cached redshift evolution factors.
+        int _scaleEvolution, _biasEvolution;
 	}; // BaoCorrelationModel
 } // baofit
 
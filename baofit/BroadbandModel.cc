@@ -10,6 +10,9 @@
 #include "boost/spirit/include/phoenix_stl.hpp"
 #include "boost/format.hpp"
 
+#include <cmath>
+#include <algorithm>
+
 namespace local = baofit;
 namespace qi = boost::spirit::qi;
 namespace phoenix = boost::phoenix;
@@ -49,12 +52,55 @@ namespace broadband {
             }
         }
     };
+    // Returns the Legendre polynomial P_Ell(mu). Only the specializations for Ell = 0-8 below
+    // are implemented.
+    template <int Ell> double legendreP(double mu);
+    template <> double legendreP<0>(double mu) { return 1; }
+    template <> double legendreP<1>(double mu) { return mu; }
+    template <> double legendreP<2>(double mu) {
+        double musq(mu*mu);
+        return (-1+3*musq)/2.;
+    }
+    template <> double legendreP<3>(double mu) {
+        double musq(mu*mu);
+        return mu*(-3+5*musq)/2.;
+    }
+    template <> double legendreP<4>(double mu) {
+        double musq(mu*mu);
+        return (3+musq*(-30+35*musq))/8.;
+    }
+    template <> double legendreP<5>(double mu) {
+        double musq(mu*mu);
+        return mu*(15+musq*(-70+63*musq))/8.;
+    }
+    template <> double legendreP<6>(double mu) {
+        double musq(mu*mu);
+        return (-5+musq*(105+musq*(-315+231*musq)))/16.;
+    }
+    template <> double legendreP<7>(double mu) {
+        double musq(mu*mu);
+        return mu*(-35+musq*(315+musq*(-693+429*musq)))/16.;
+    }
+    template <> double legendreP<8>(double mu) {
+        double musq(mu*mu);
+        return (35+musq*(-1260+musq*(6930+musq*(-12012+6435*musq))))/128.;
+    }
+    // Fills result[0..n-1] with P_Ell(mu[i]).
+    template <int Ell> void fillLegendreP(int n, double const *mu, double *result) {
+        for(int i = 0; i < n; ++i) result[i] = legendreP<Ell>(mu[i]);
+    }
+    // Kernels for each supported multipole, indexed by ell.
+    int const maxEll = 8;
+    void (* const legendreKernels[maxEll+1])(int n, double const *mu, double *result) = {
+        &fillLegendreP<0>, &fillLegendreP<1>, &fillLegendreP<2>, &fillLegendreP<3>, &fillLegendreP<4>,
+        &fillLegendreP<5>, &fillLegendreP<6>, &fillLegendreP<7>, &fillLegendreP<8>
+    };
 } // broadband
 } // baofit
 
 local::BroadbandModel::BroadbandModel(std::string const &name, std::string const &tag,
 std::string const &paramSpec, double r0, double z0, AbsCorrelationModel *base)
-: AbsCorrelationModel(name), _r0(r0), _z0(z0), _base(base ? *base:*this)
+: AbsCorrelationModel(name), _nterms(0), _r0(r0), _z0(z0), _base(base ? *base:*this)
 {
     // Parse the parameter specification string.
     broadband::Grammar grammar;
@@ -77,15 +123,22 @@ std::string const &paramSpec, double r0, double z0, AbsCorrelationModel *base)
     if(_muIndexMax < _muIndexMin || _muIndexStep <= 0) {
         throw RuntimeError("BroadbandModel: illegal mu-parameter specification.");
     }
-    if(_muIndexMin < 0 || _muIndexMax > 8) {
+    if(_muIndexMin < 0 || _muIndexMax > broadband::maxEll) {
         throw RuntimeError("BroadbandModel: only multipoles 0-8 are allowed in mu-parameter specification.");
     }
+    // Select the kernel for each mu factor.
+    for(int muIndex = _muIndexMin; muIndex <= _muIndexMax; muIndex += _muIndexStep) {
+        _muKernels.push_back(broadband::legendreKernels[muIndex]);
+    }
     _zIndexMin = grammar.specs[6];
     _zIndexMax = grammar.specs[7];
     _zIndexStep = grammar.specs[8];
     if(_zIndexMax < _zIndexMin || _zIndexStep <= 0) {
         throw RuntimeError("BroadbandModel: illegal z-parameter specification.");
     }
+    _nr = (_rIndexMax - _rIndexMin)/_rIndexStep + 1;
+    _nmu = (_muIndexMax - _muIndexMin)/_muIndexStep + 1;
+    _nz = (_zIndexMax - _zIndexMin)/_zIndexStep + 1;
     // Define our parameters.
     bool first(true);
     double perr(1e-3);
@@ -94,63 +147,116 @@ std::string const &paramSpec, double r0, double z0, AbsCorrelationModel *base)
         for(int muIndex = _muIndexMin; muIndex <= _muIndexMax; muIndex += _muIndexStep) {
             for(int rIndex = _rIndexMin; rIndex <= _rIndexMax; rIndex += _rIndexStep) {
                 int index = _base.defineParameter(boost::str(pname % tag % zIndex % muIndex % rIndex),0,perr);
+                // Our prediction is linear in each coefficient.
+                _base._declareLinearParameter(index);
                 if(first) {
                     _indexBase = index;
                     first = false;
                 }
+                _nterms++;
             }
         }
     }
+    _coefs.resize(_nterms);
 }
 
 local::BroadbandModel::~BroadbandModel() { }
 
 double local::legendreP(int ell, double mu) {
-    double musq(mu*mu);
     switch(ell) {
     case 0:
-        return 1;
+        return broadband::legendreP<0>(mu);
     case 1:
-        return mu;
+        return broadband::legendreP<1>(mu);
     case 2:
-        return (-1+3*musq)/2.;
+        return broadband::legendreP<2>(mu);
     case 3:
-        return mu*(-3+5*musq)/2.;
+        return broadband::legendreP<3>(mu);
     case 4:
-        return (3+musq*(-30+35*musq))/8.;
+        return broadband::legendreP<4>(mu);
     case 5:
-        return mu*(15+musq*(-70+63*musq))/8.;
+        return broadband::legendreP<5>(mu);
     case 6:
-        return (-5+musq*(105+musq*(-315+231*musq)))/16.;
+        return broadband::legendreP<6>(mu);
     case 7:
-        return mu*(-35+musq*(315+musq*(-693+429*musq)))/16.;
+        return broadband::legendreP<7>(mu);
     case 8:
-        return (35+musq*(-1260+musq*(6930+musq*(-12012+6435*musq))))/128.;
+        return broadband::legendreP<8>(mu);
     }
     throw RuntimeError("legendreP: only ell = 0-8 are supported.");
     return 0;
 }
 
 double local::BroadbandModel::_evaluate(double r, double mu, double z, bool anyChanged) const {
-    double xi(0);
-    double rr = r/_r0;
-    double zz = (1+z)/(1+_z0);
-    int indexOffset(0);
-    for(int zIndex = _zIndexMin; zIndex <= _zIndexMax; zIndex += _zIndexStep) {
-        double zFactor = std::pow(zz,zIndex);
-        for(int muIndex = _muIndexMin; muIndex <= _muIndexMax; muIndex += _muIndexStep) {
-            double muFactor = legendreP(muIndex,mu);
-            for(int rIndex = _rIndexMin; rIndex <= _rIndexMax; rIndex += _rIndexStep) {
-                double rFactor = std::pow(rIndex > 0 ? rr-1 : rr, rIndex);
-                // Look up the coefficient for this combination of rIndex,muIndex,zIndex.
-                double coef = _base.getParameterValue(_indexBase + indexOffset);
-                indexOffset++;
-                // Add this term to the result.
-                xi += coef*rFactor*muFactor*zFactor;
+    double result;
+    bindRange(1,&r,&mu,&z,_getDefaultContext());
+    _evaluateBatch(1,&r,&mu,&z,&result,_getDefaultContext());
+    return result;
+}
+
+void local::BroadbandModel::_prepareEvaluation(bool anyChanged) {
+    // Look up the coefficient for each combination of rIndex,muIndex,zIndex once for all batches.
+    for(int indexOffset = 0; indexOffset < _nterms; ++indexOffset) {
+        _coefs[indexOffset] = _base.getParameterValue(_indexBase + indexOffset);
+    }
+}
+
+void local::BroadbandModel::_bindRange(int n, double const *r, double const *mu, double const *z,
+EvaluationContext &context) const {
+    // Calculate the factors along each axis, with factor k of each axis in a block at offset k*n.
+    std::vector<double> factors((_nr + _nmu + _nz)*n);
+    double *rFactors = &factors[0], *muFactors = rFactors + _nr*n, *zFactors = muFactors + _nmu*n;
+    for(int i = 0; i < n; ++i) {
+        double rr = r[i]/_r0;
+        double zz = (1+z[i])/(1+_z0);
+        int k(0);
+        for(int rIndex = _rIndexMin; rIndex <= _rIndexMax; rIndex += _rIndexStep) {
+            rFactors[(k++)*n + i] = std::pow(rIndex > 0 ? rr-1 : rr, rIndex);
+        }
+        k = 0;
+        for(int zIndex = _zIndexMin; zIndex <= _zIndexMax; zIndex += _zIndexStep) {
+            zFactors[(k++)*n + i] = std::pow(zz,zIndex);
+        }
+    }
+    for(int k = 0; k < _nmu; ++k) _muKernels[k](n,mu,muFactors + k*n);
+    // Combine them into the design matrix of our terms, in the same order as our parameters.
+    std::vector<double> &design = context.getBuffer(this,DESIGN);
+    design.resize(_nterms*n);
+    double *term = &design[0];
+    for(int zk = 0; zk < _nz; ++zk) {
+        double const *zFactor = zFactors + zk*n;
+        for(int muk = 0; muk < _nmu; ++muk) {
+            double const *muFactor = muFactors + muk*n;
+            for(int rk = 0; rk < _nr; ++rk) {
+                double const *rFactor = rFactors + rk*n;
+                for(int i = 0; i < n; ++i) term[i] = rFactor[i]*muFactor[i]*zFactor[i];
+                term += n;
             }
         }
     }
-    return xi;
+}
+
+void local::BroadbandModel::_evaluateBatch(int n, double const *r, double const *mu, double const *z,
+double *result, EvaluationContext &context) const {
+    if(n <= 0) return;
+    double const *design = &context.getBuffer(this,DESIGN)[0];
+    for(int i = 0; i < n; ++i) result[i] = 0;
+    for(int k = 0; k < _nterms; ++k) {
+        double coef = _coefs[k];
+        // Terms with a zero coefficient (usually fixed) do not contribute.
+        if(0 == coef) continue;
+        double const *term = design + k*n;
+        for(int i = 0; i < n; ++i) result[i] += coef*term[i];
+    }
+}
+
+void local::BroadbandModel::_evaluateLinearBasis(int n, double const *r, double const *mu, double const *z,
+double *basis, int stride, EvaluationContext &context) const {
+    if(n <= 0) return;
+    double const *design = &context.getBuffer(this,DESIGN)[0];
+    for(int k = 0; k < _nterms; ++k) {
+        std::copy(design + k*n,design + (k+1)*n,basis + k*stride);
+    }
 }
 
 double local::BroadbandModel::_evaluate(double r, cosmo::Multipole multipole, double z,
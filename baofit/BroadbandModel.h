@@ -5,6 +5,8 @@
 
 #include "baofit/AbsCorrelationModel.h"
 
+#include <vector>
+
 namespace baofit {
     // Represents a smooth two-point correlation model parameterized in powers of comoving separation
     // and redshift, and multipoles of mu = r.z
@@ -28,13 +30,34 @@ namespace baofit {
         // Returns the correlation function for the specified multipole at co-moving pair separation
         // r and average pair redshift z.
         virtual double _evaluate(double r, cosmo::Multipole multipole, double z, bool anyChanged) const;
+        // Loads our coefficients from the current parameter values.
+        virtual void _prepareEvaluation(bool anyChanged);
+        // Precomputes the design matrix of our expansion, whose terms are products of r, mu and z
+        // factors that do not depend on parameter values, so that evaluations only need a
+        // matrix-vector product with our coefficients.
+        virtual void _bindRange(int n, double const *r, double const *mu, double const *z,
+            EvaluationContext &context) const;
+        // Fills result[0..n-1] with the correlation function evaluated at each (r[i],mu[i],z[i]).
+        virtual void _evaluateBatch(int n, double const *r, double const *mu, double const *z,
+            double *result, EvaluationContext &context) const;
+        // Fills basis[k*stride+i] with the k-th term of our expansion evaluated at (r[i],mu[i],z[i]).
+        virtual void _evaluateLinearBasis(int n, double const *r, double const *mu, double const *z,
+            double *basis, int stride, EvaluationContext &context) const;
 	private:
-        int _indexBase;
+        int _indexBase, _nterms;
         int _rIndexMin,_rIndexMax,_rIndexStep;
         int _muIndexMin,_muIndexMax,_muIndexStep;
         int _zIndexMin,_zIndexMax,_zIndexStep;
+        int _nr,_nmu,_nz;
+        // The design matrix of the bound bins is stored in a context buffer with term k, in the
+        // order of our parameters, in a block at offset k*n.
+        enum { DESIGN = 0 };
+        // Kernels that fill the Legendre polynomial of each mu factor, selected at construction.
+        typedef void (*LegendreKernel)(int n, double const *mu, double *result);
+        std::vector<LegendreKernel> _muKernels;
         double _r0, _z0;
         AbsCorrelationModel &_base;
+        std::vector<double> _coefs;
 	}; // BroadbandModel
     double legendreP(int ell, double mu);
 } // baofit
@@ -2,6 +2,7 @@
 
 #include "baofit/ComovingCorrelationData.h"
 #include "baofit/RuntimeError.h"
+#include "baofit/quadrature.h"
 
 namespace local = baofit;
 
@@ -53,3 +54,27 @@ double local::ComovingCorrelationData::getRedshift(int index) const {
     _setIndex(index);
     return _binCenter[2];
 }
+
+void local::ComovingCorrelationData::getBinQuadrature(int index, int order, std::vector<double> &r,
+std::vector<double> &mu, std::vector<double> &z, std::vector<double> &weight) const {
+    _setIndex(index);
+    getBinWidths(index,_binWidth);
+    std::vector<double> rNodes, rWeights, muNodes, muWeights;
+    getGaussLegendreRule(order,_binCenter[0] - _binWidth[0]/2,_binCenter[0] + _binWidth[0]/2,rNodes,rWeights);
+    getGaussLegendreRule(order,_binCenter[1] - _binWidth[1]/2,_binCenter[1] + _binWidth[1]/2,muNodes,muWeights);
+    r.resize(0);
+    mu.resize(0);
+    weight.resize(0);
+    // The number of pairs at separation r is proportional to r^2 within a bin.
+    double norm(0);
+    for(int i = 0; i < order; ++i) {
+        for(int j = 0; j < order; ++j) {
+            r.push_back(rNodes[i]);
+            mu.push_back(muNodes[j]);
+            weight.push_back(rWeights[i]*rNodes[i]*rNodes[i]*muWeights[j]);
+            norm += weight.back();
+        }
+    }
+    for(int k = 0; k < weight.size(); ++k) weight[k] /= norm;
+    z.assign(weight.size(),_binCenter[2]);
+}
@@ -24,6 +24,9 @@ namespace baofit {
         virtual double getCosAngle(int index) const;
         // Returns the redshift associated with the specified global index.
         virtual double getRedshift(int index) const;
+        // Uses a Gauss-Legendre rule in r and mu over the bin extent, weighted by r^2.
+        virtual void getBinQuadrature(int index, int order, std::vector<double> &r,
+            std::vector<double> &mu, std::vector<double> &z, std::vector<double> &weight) const;
         // Finalize a comoving dataset by pruning to the limits specified in our constructor.
         // No further changes to our "shape" are possible after finalizing. See the documentation
         // for BinnedData::finalize() for details.
@@ -31,7 +34,7 @@ namespace baofit {
 	private:
         void _setIndex(int index) const;
         mutable int _lastIndex;
-        mutable std::vector<double> _binCenter;
+        mutable std::vector<double> _binCenter, _binWidth;
 	}; // ComovingCorrelationData
 } // baofit
 
@@ -5,6 +5,7 @@
 #include "baofit/AbsCorrelationData.h"
 #include "baofit/AbsCorrelationModel.h"
 #include "baofit/CorrelationFitter.h"
+#include "baofit/FitProfile.h"
 
 #include "likely/FunctionMinimum.h"
 #include "likely/FitParameter.h"
@@ -28,7 +29,8 @@ namespace local = baofit;
 
 local::CorrelationAnalyzer::CorrelationAnalyzer(std::string const &method, double rmin, double rmax,
 bool verbose, bool scalarWeights)
-: _method(method), _rmin(rmin), _rmax(rmax), _verbose(verbose), _resampler(scalarWeights)
+: _method(method), _rmin(rmin), _rmax(rmax), _verbose(verbose), _analyticLinear(false), _nthreads(1),
+_cacheSize(0), _binOrder(1), _resampler(scalarWeights)
 {
     if(rmin >= rmax) {
         throw RuntimeError("CorrelationAnalyzer: expected rmin < rmax.");
@@ -37,6 +39,42 @@ bool verbose, bool scalarWeights)
 
 local::CorrelationAnalyzer::~CorrelationAnalyzer() { }
 
+void local::CorrelationAnalyzer::setNThreads(int nthreads) {
+    if(nthreads < 1) {
+        throw RuntimeError("CorrelationAnalyzer: expected nthreads >= 1.");
+    }
+    _nthreads = nthreads;
+}
+
+void local::CorrelationAnalyzer::setLikelihoodCacheSize(int size) {
+    if(size < 0) {
+        throw RuntimeError("CorrelationAnalyzer: expected likelihood cache size >= 0.");
+    }
+    _cacheSize = size;
+}
+
+void local::CorrelationAnalyzer::setBinIntegration(int order) {
+    if(order < 1) {
+        throw RuntimeError("CorrelationAnalyzer: expected bin integration order >= 1.");
+    }
+    _binOrder = order;
+}
+
+void local::CorrelationAnalyzer::setProfileName(std::string const &filename) {
+    _profileOut.reset(new std::ofstream(filename.c_str()));
+    if(!*_profileOut) {
+        throw RuntimeError("CorrelationAnalyzer: unable to open profile file " + filename);
+    }
+    *_profileOut << "# label item seconds count cached" << std::endl;
+}
+
+void local::CorrelationAnalyzer::_reportProfile(FitProfile const &profile, std::string const &label) const {
+    std::cout << std::endl;
+    profile.printToStream(std::cout,label);
+    profile.saveToStream(*_profileOut,label);
+    _profileOut->flush();
+}
+
 void local::CorrelationAnalyzer::setZData(double zdata) {
     if(zdata < 0) {
         throw RuntimeError("CorrelationAnalyzer: expected zdata >= 0.");        
@@ -45,13 +83,26 @@ void local::CorrelationAnalyzer::setZData(double zdata) {
 }
 
 int local::CorrelationAnalyzer::addData(AbsCorrelationDataCPtr data, int reuseCovIndex) {
-    return _resampler.addObservation(
+    int index = _resampler.addObservation(
         boost::dynamic_pointer_cast<const likely::BinnedData>(data),reuseCovIndex);
+    _icovSources.push_back(reuseCovIndex < 0 ? data : _icovSources[reuseCovIndex]);
+    return index;
 }
 
 local::AbsCorrelationDataPtr local::CorrelationAnalyzer::getCombined(bool verbose, bool finalized) const {
     AbsCorrelationDataPtr combined =
         boost::dynamic_pointer_cast<baofit::AbsCorrelationData>(_resampler.combined());
+    // The combined inverse covariance is the sum of each dataset's, so its nonzero elements are
+    // known when they are known for every dataset.
+    combined->forgetInverseCovarianceElements();
+    std::vector<std::pair<int,int> > elements;
+    bool known(true);
+    for(int k = 0; known && k < _icovSources.size(); ++k) {
+        known = _icovSources[k]->getInverseCovarianceElements(elements);
+    }
+    if(known) {
+        for(int k = 0; k < _icovSources.size(); ++k) combined->addInverseCovarianceElements(*_icovSources[k]);
+    }
     int nbefore = combined->getNBinsWithData();
     if(finalized) combined->finalize();
     if(verbose && finalized) {
@@ -156,8 +207,17 @@ std::string const &scaleName) const {
 
 likely::FunctionMinimumPtr local::CorrelationAnalyzer::fitSample(
 AbsCorrelationDataCPtr sample, std::string const &config) const {
-    CorrelationFitter fitter(sample,_model);
+    CorrelationFitter fitter(sample,_model,_nthreads);
+    fitter.setBinIntegration(_binOrder);
+    fitter.setAnalyticLinearParameters(_analyticLinear);
+    fitter.setLikelihoodCacheSize(_cacheSize);
+    FitProfilePtr profile;
+    if(_profileOut) {
+        profile.reset(new FitProfile());
+        fitter.setProfile(profile);
+    }
     likely::FunctionMinimumPtr fmin = fitter.fit(_method,config);
+    if(profile) _reportProfile(*profile,0 == config.size() ? "fit" : "refit");
     if(_verbose) {
         double chisq = 2*fmin->getMinValue();
         int nbins = sample->getNBinsWithData();
@@ -167,6 +227,11 @@ AbsCorrelationDataCPtr sample, std::string const &config) const {
             << nbins << '-' << npar << "), prob = " << prob << ", log(det(Covariance)) = "
             << sample->getCovarianceMatrix()->getLogDeterminant() << std::endl << std::endl;
         fmin->printToStream(std::cout);
+        if(_cacheSize > 0) {
+            long nHits, nMisses;
+            fitter.getLikelihoodCacheStatistics(nHits,nMisses);
+            std::cout << "Likelihood cache: " << nHits << " hits, " << nMisses << " misses." << std::endl;
+        }
     }
     return fmin;
 }
@@ -325,7 +390,8 @@ std::string const &saveName, int nsave) const {
     std::vector<double> pvalues;
     likely::getFitParameterValues(parameters,pvalues);
     // Build a fitter to calculate the truth vector.
-    CorrelationFitter fitter(prototype, _model);
+    CorrelationFitter fitter(prototype,_model,_nthreads);
+    fitter.setBinIntegration(_binOrder);
     // Calculate the truth vector.
     std::vector<double> truth;
     fitter.getPrediction(pvalues,truth);
@@ -432,13 +498,24 @@ std::string const &refitConfig, std::string const &saveName, int nsave) const {
     int nsamples(0);
     while(sample = sampler.nextSample()) {
         // Fit the sample.
-        baofit::CorrelationFitter fitEngine(sample,_model);
+        baofit::CorrelationFitter fitEngine(sample,_model,_nthreads);
+        fitEngine.setBinIntegration(_binOrder);
+        fitEngine.setAnalyticLinearParameters(_analyticLinear);
+        fitEngine.setLikelihoodCacheSize(_cacheSize);
+        FitProfilePtr profile;
+        if(_profileOut) {
+            profile.reset(new FitProfile());
+            fitEngine.setProfile(profile);
+        }
+        std::string label = boost::str(boost::format("%s-%d") % method % nsamples);
         likely::FunctionMinimumPtr sampleMin = fitEngine.fit(_method);
+        if(profile) _reportProfile(*profile,label);
         bool ok = (sampleMin->getStatus() == likely::FunctionMinimum::OK);
         // Refit the sample if requested and the first fit succeeded.
         likely::FunctionMinimumPtr sampleMinRefit;
         if(ok && fmin2) {
             sampleMinRefit = fitEngine.fit(_method,refitConfig);
+            if(profile) _reportProfile(*profile,label + "-refit");
             // Did this fit succeed also?
             if(sampleMinRefit->getStatus() != likely::FunctionMinimum::OK) ok = false;
         }
@@ -481,7 +558,8 @@ std::string const &saveName, int nsave) const {
     }
     // Create a fitter to calculate the likelihood.
     AbsCorrelationDataCPtr combined = getCombined(true);
-    CorrelationFitter fitter(combined,_model);
+    CorrelationFitter fitter(combined,_model,_nthreads);
+    fitter.setBinIntegration(_binOrder);
     // Generate the MCMC chains, saving the results in a vector.
     std::vector<double> samples;
     fitter.mcmc(fmin, nchain, interval, samples);
@@ -527,8 +605,50 @@ AbsCorrelationDataCPtr combined, std::string const &script, bool dumpGradients)
     likely::getFitParameterValues(parameters,parameterValues);
     int npar = fmin->getNParameters();
     if(dumpGradients) likely::getFitParameterErrors(parameters,parameterErrors);
+    // Collect the coordinates of each 3D bin in the combined dataset.
+    int nbins = combined->getNBinsWithData();
+    std::vector<double> rValues, muValues, zValues;
+    std::vector<cosmo::Multipole> multipoleValues;
+    for(likely::BinnedData::IndexIterator iter = combined->begin(); iter != combined->end(); ++iter) {
+        int index(*iter);
+        zValues.push_back(combined->getRedshift(index));
+        rValues.push_back(combined->getRadius(index));
+        if(type == AbsCorrelationData::Coordinate) {
+            muValues.push_back(combined->getCosAngle(index));
+        }
+        else {
+            multipoleValues.push_back(combined->getMultipole(index));
+        }
+    }
+    // Calculate the predictions for all bins with the same fitter configuration used for fits,
+    // so that any bin integration is included.
+    CorrelationFitter fitter(combined,_model,_nthreads);
+    fitter.setBinIntegration(_binOrder);
+    std::vector<double> predicted;
+    fitter.getPrediction(parameterValues,predicted);
+    // Calculate the gradients of all bins with respect to each parameter, using two predictions
+    // per parameter. Gradients are stored as gradients[ipar*nbins + offset].
+    std::vector<double> gradients, predHi, predLo;
+    if(dumpGradients) {
+        gradients.resize(npar*nbins,0);
+        for(int ipar = 0; ipar < npar; ++ipar) {
+            double dpar(0.1*parameterErrors[ipar]);
+            if(dpar > 0) {
+                double p0 = parameterValues[ipar];
+                parameterValues[ipar] = p0 + 0.5*dpar;
+                fitter.getPrediction(parameterValues,predHi);
+                parameterValues[ipar] = p0 - 0.5*dpar;
+                fitter.getPrediction(parameterValues,predLo);
+                for(int offset = 0; offset < nbins; ++offset) {
+                    gradients[ipar*nbins + offset] = (predHi[offset] - predLo[offset])/dpar;
+                }
+                parameterValues[ipar] = p0;
+            }
+        }
+    }
     // Loop over 3D bins in the combined dataset.
     std::vector<double> centers;
+    int offset(0);
     for(likely::BinnedData::IndexIterator iter = combined->begin(); iter != combined->end(); ++iter) {
         int index(*iter);
         out << index;
@@ -538,41 +658,20 @@ AbsCorrelationDataCPtr combined, std::string const &script, bool dumpGradients)
         }
         double data = combined->getData(index);
         double error = combined->hasCovariance() ? std::sqrt(combined->getCovariance(index,index)) : 0;
-        double z = combined->getRedshift(index);
-        double r = combined->getRadius(index);
-        double predicted,mu;
-        cosmo::Multipole multipole;
         if(type == AbsCorrelationData::Coordinate) {
-            mu = combined->getCosAngle(index);
-            predicted = _model->evaluate(r,mu,z,parameterValues);
-            out  << ' ' << r << ' ' << mu << ' ' << z;
+            out  << ' ' << rValues[offset] << ' ' << muValues[offset] << ' ' << zValues[offset];
         }
         else {
-            multipole = combined->getMultipole(index);
-            predicted = _model->evaluate(r,multipole,z,parameterValues);
-            out  << ' ' << r << ' ' << (int)multipole << ' ' << z;
+            out  << ' ' << rValues[offset] << ' ' << (int)multipoleValues[offset] << ' ' << zValues[offset];
         }
-        out << ' ' << predicted << ' ' << data << ' ' << error;
+        out << ' ' << predicted[offset] << ' ' << data << ' ' << error;
         if(dumpGradients) {
             for(int ipar = 0; ipar < npar; ++ipar) {
-                double gradient(0), dpar(0.1*parameterErrors[ipar]);
-                if(dpar > 0) {
-                    double p0 = parameterValues[ipar];
-                    parameterValues[ipar] = p0 + 0.5*dpar;
-                    double predHi = (type == AbsCorrelationData::Coordinate) ?
-                        _model->evaluate(r,mu,z,parameterValues) :
-                        _model->evaluate(r,multipole,z,parameterValues);
-                    parameterValues[ipar] = p0 - 0.5*dpar;
-                    double predLo = (type == AbsCorrelationData::Coordinate) ?
-                        _model->evaluate(r,mu,z,parameterValues) :
-                        _model->evaluate(r,multipole,z,parameterValues);
-                    gradient = (predHi - predLo)/dpar;
-                    parameterValues[ipar] = p0;
-                }
-                out << ' ' << gradient;
+                out << ' ' << gradients[ipar*nbins + offset];
             }
         }
         out << std::endl;
+        offset++;
     }
 }
 
@@ -588,15 +687,25 @@ int ndump, std::string const &script, bool oneLine) const {
     // Get the parameter values (floating + fixed)
     likely::Parameters parameterValues;
     likely::getFitParameterValues(parameters,parameterValues);
-    // Loop over the specified radial grid.
+    // Build the specified radial grid with (mono,quad,hexa) at each radius.
     double dr((_rmax - _rmin)/(ndump-1));
+    std::vector<double> rValues, zValues(3*ndump,_zdata), predicted;
+    std::vector<cosmo::Multipole> multipoleValues;
+    rValues.reserve(3*ndump);
+    multipoleValues.reserve(3*ndump);
     for(int rIndex = 0; rIndex < ndump; ++rIndex) {
         double rval(_rmin + dr*rIndex);
-        double mono = _model->evaluate(rval,cosmo::Monopole,_zdata,parameterValues);
-        double quad = _model->evaluate(rval,cosmo::Quadrupole,_zdata,parameterValues);
-        double hexa = _model->evaluate(rval,cosmo::Hexadecapole,_zdata,parameterValues);
+        rValues.insert(rValues.end(),3,rval);
+        multipoleValues.push_back(cosmo::Monopole);
+        multipoleValues.push_back(cosmo::Quadrupole);
+        multipoleValues.push_back(cosmo::Hexadecapole);
+    }
+    // Evaluate the model on the whole grid in a single batch.
+    _model->evaluateBatch(rValues,multipoleValues,zValues,parameterValues,predicted);
+    for(int rIndex = 0; rIndex < ndump; ++rIndex) {
+        double mono = predicted[3*rIndex], quad = predicted[3*rIndex+1], hexa = predicted[3*rIndex+2];
         // Output the model predictions for this radius in the requested format.
-        if(!oneLine) out << rval;
+        if(!oneLine) out << rValues[3*rIndex];
         out << ' ' << mono << ' ' << quad << ' ' << hexa;
         if(!oneLine) out << std::endl;
     }
@@ -604,7 +713,8 @@ int ndump, std::string const &script, bool oneLine) const {
 
 void local::CorrelationAnalyzer::getDecorrelatedWeights(AbsCorrelationDataCPtr data,
 likely::Parameters const &params, std::vector<double> &dweights) const {
-    CorrelationFitter fitter(data, _model);
+    CorrelationFitter fitter(data,_model,_nthreads);
+    fitter.setBinIntegration(_binOrder);
     std::vector<double> prediction;
     fitter.getPrediction(params,prediction);
     data->getDecorrelatedWeights(prediction,dweights);
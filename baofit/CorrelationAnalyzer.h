@@ -11,6 +11,7 @@
 #include "likely/FitParameter.h"
 
 #include <iosfwd>
+#include <vector>
 
 namespace baofit {
     // Accumulates correlation data and manages its analysis.
@@ -23,6 +24,20 @@ namespace baofit {
 		virtual ~CorrelationAnalyzer();
 		// Set the verbose level during analysis.
         void setVerbose(bool value);
+        // Sets the number of threads used to calculate model predictions during each fit.
+        void setNThreads(int nthreads);
+        // Solves for any linear model parameters analytically during each fit. See
+        // CorrelationFitter::setAnalyticLinearParameters for details.
+        void setAnalyticLinearParameters(bool value);
+        // Caches up to size likelihood values during each fit. See
+        // CorrelationFitter::setLikelihoodCacheSize for details.
+        void setLikelihoodCacheSize(int size);
+        // Averages model predictions over the extent of each bin using order x order quadrature
+        // nodes. See CorrelationFitter::setBinIntegration for details.
+        void setBinIntegration(int order);
+        // Profiles each subsequent fit, printing a summary of where its time was spent and
+        // saving the same information to the specified filename. See FitProfile for details.
+        void setProfileName(std::string const &filename);
 		// Adds a new correlation data object to this analyzer. Reuse the covariance of a
 		// previously added dataset specified by reuseCovIndex, unless it is < 0. Returns
 		// the index of the newly added dataset.
@@ -132,9 +147,16 @@ namespace baofit {
 	private:
         std::string _method;
         double _rmin, _rmax, _zdata;
-        bool _verbose;
+        bool _verbose, _analyticLinear;
+        int _nthreads, _cacheSize, _binOrder;
         likely::BinnedDataResampler _resampler;
+        // The dataset whose inverse covariance applies to each added dataset, which is an
+        // earlier dataset when its covariance is being reused.
+        std::vector<AbsCorrelationDataCPtr> _icovSources;
         AbsCorrelationModelPtr _model;
+        boost::shared_ptr<std::ofstream> _profileOut;
+        // Prints the specified fit profile and saves it to our profile file.
+        void _reportProfile(FitProfile const &profile, std::string const &label) const;
         
         class AbsSampler;
         class JackknifeSampler;
@@ -148,6 +170,7 @@ namespace baofit {
 	}; // CorrelationAnalyzer
 	
     inline void CorrelationAnalyzer::setVerbose(bool value) { _verbose = value; }
+    inline void CorrelationAnalyzer::setAnalyticLinearParameters(bool value) { _analyticLinear = value; }
     inline int CorrelationAnalyzer::getNData() const { return _resampler.getNObservations(); }
     inline void CorrelationAnalyzer::setModel(AbsCorrelationModelPtr model) { _model = model; }
 
@@ -3,21 +3,180 @@
 #include "baofit/CorrelationFitter.h"
 #include "baofit/RuntimeError.h"
 #include "baofit/AbsCorrelationModel.h"
+#include "baofit/EvaluationContext.h"
+#include "baofit/FitProfile.h"
 
 #include "likely/AbsEngine.h"
+#include "likely/CovarianceMatrix.h"
 #include "likely/FitParameter.h"
 #include "likely/FunctionMinimum.h"
 #include "likely/MarkovChainEngine.h"
 
 #include "boost/bind.hpp"
 #include "boost/ref.hpp"
+#include "boost/format.hpp"
+#include "boost/thread.hpp"
+#include "boost/unordered_map.hpp"
+#include "boost/functional/hash.hpp"
 
 #include <iostream>
+#include <list>
+#include <exception>
+#include <algorithm>
+#include <cmath>
 
 namespace local = baofit;
 
-local::CorrelationFitter::CorrelationFitter(AbsCorrelationDataCPtr data, AbsCorrelationModelPtr model)
-: _data(data), _model(model), _errorScale(1), _type(data->getTransverseBinningType())
+namespace baofit {
+    // The largest fraction of nonzero off-diagonal inverse covariance elements for which we use
+    // sparse storage, since each sparse element costs an extra indirect load.
+    double const maxSparseFill = 0.3;
+}
+
+class local::CorrelationFitter::WorkerPool {
+public:
+    WorkerPool(CorrelationFitter const &fitter, int nthreads);
+    ~WorkerPool();
+    // Fills prediction with all ranges, using the calling thread for range 0.
+    void run(double *prediction);
+private:
+    void _work(int index);
+    CorrelationFitter const &_fitter;
+    boost::thread_group _threads;
+    boost::mutex _mutex;
+    boost::condition_variable _start, _finished;
+    double *_prediction;
+    int _generation, _pending;
+    bool _stop;
+    std::string _error;
+};
+
+local::CorrelationFitter::WorkerPool::WorkerPool(CorrelationFitter const &fitter, int nthreads)
+: _fitter(fitter), _prediction(0), _generation(0), _pending(0), _stop(false)
+{
+    for(int index = 1; index < nthreads; ++index) {
+        _threads.create_thread(boost::bind(&WorkerPool::_work,this,index));
+    }
+}
+
+local::CorrelationFitter::WorkerPool::~WorkerPool() {
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _start.notify_all();
+    _threads.join_all();
+}
+
+void local::CorrelationFitter::WorkerPool::run(double *prediction) {
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _prediction = prediction;
+        _pending = _threads.size();
+        _error.clear();
+        ++_generation;
+    }
+    _start.notify_all();
+    // Evaluate the first range in this thread while the workers handle the others.
+    std::string error;
+    try {
+        _fitter._evaluateRange(0,prediction);
+    }
+    catch(std::exception const &e) {
+        error = e.what();
+    }
+    // Wait for all workers to finish before reporting any errors.
+    boost::unique_lock<boost::mutex> lock(_mutex);
+    while(_pending > 0) _finished.wait(lock);
+    if(error.empty()) error = _error;
+    if(!error.empty()) {
+        throw RuntimeError("CorrelationFitter: model evaluation failed: " + error);
+    }
+}
+
+void local::CorrelationFitter::WorkerPool::_work(int index) {
+    int generation(0);
+    while(true) {
+        // Wait until there is a new prediction to calculate, or we are asked to stop.
+        double *prediction;
+        {
+            boost::unique_lock<boost::mutex> lock(_mutex);
+            while(_generation == generation && !_stop) _start.wait(lock);
+            if(_stop) return;
+            generation = _generation;
+            prediction = _prediction;
+        }
+        std::string error;
+        try {
+            _fitter._evaluateRange(index,prediction);
+        }
+        catch(std::exception const &e) {
+            error = e.what();
+        }
+        {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            if(!error.empty()) _error = error;
+            if(--_pending == 0) _finished.notify_one();
+        }
+    }
+}
+
+class local::CorrelationFitter::LikelihoodCache {
+public:
+    LikelihoodCache(int capacity);
+    // Looks up the value cached for the specified parameters and marks it as the most recently
+    // used. Returns false if no value is cached.
+    bool find(likely::Parameters const &params, double &value);
+    // Caches a new value for the specified parameters, first evicting the least recently used
+    // value if we are already full.
+    void add(likely::Parameters const &params, double value);
+    // Removes all cached values.
+    void clear();
+    long nHits, nMisses;
+private:
+    typedef std::list<std::pair<likely::Parameters,double> > Entries;
+    typedef boost::unordered_map<likely::Parameters,Entries::iterator,
+        boost::hash<likely::Parameters> > Index;
+    int _capacity;
+    Entries _entries;
+    Index _index;
+};
+
+local::CorrelationFitter::LikelihoodCache::LikelihoodCache(int capacity)
+: nHits(0), nMisses(0), _capacity(capacity)
+{ }
+
+bool local::CorrelationFitter::LikelihoodCache::find(likely::Parameters const &params, double &value) {
+    Index::iterator found = _index.find(params);
+    if(found == _index.end()) {
+        ++nMisses;
+        return false;
+    }
+    ++nHits;
+    // Move this entry to the front of our list.
+    _entries.splice(_entries.begin(),_entries,found->second);
+    value = found->second->second;
+    return true;
+}
+
+void local::CorrelationFitter::LikelihoodCache::add(likely::Parameters const &params, double value) {
+    if(_entries.size() >= _capacity) {
+        _index.erase(_entries.back().first);
+        _entries.pop_back();
+    }
+    _entries.push_front(std::make_pair(params,value));
+    _index[params] = _entries.begin();
+}
+
+void local::CorrelationFitter::LikelihoodCache::clear() {
+    _index.clear();
+    _entries.clear();
+}
+
+local::CorrelationFitter::CorrelationFitter(AbsCorrelationDataCPtr data, AbsCorrelationModelPtr model,
+int nthreads)
+: _data(data), _model(model), _errorScale(1), _type(data->getTransverseBinningType()),
+_analyticLinear(false), _solveLinear(false)
 {
     if(!data || 0 == data->getNBinsWithData()) {
         throw RuntimeError("CorrelationFitter: need some data to fit.");
@@ -25,6 +184,157 @@ local::CorrelationFitter::CorrelationFitter(AbsCorrelationDataCPtr data, AbsCorr
     if(!model) {
         throw RuntimeError("CorrelationFitter: need a model to fit.");
     }
+    if(nthreads < 1) {
+        throw RuntimeError("CorrelationFitter: expected nthreads >= 1.");
+    }
+    // Copy the coordinates and value of each bin with data.
+    int nbins = data->getNBinsWithData();
+    _r.reserve(nbins);
+    _z.reserve(nbins);
+    _dataValues.reserve(nbins);
+    if(_type == AbsCorrelationData::Coordinate) {
+        _mu.reserve(nbins);
+    }
+    else {
+        _multipole.reserve(nbins);
+    }
+    for(baofit::AbsCorrelationData::IndexIterator iter = data->begin(); iter != data->end(); ++iter) {
+        int index(*iter);
+        _r.push_back(data->getRadius(index));
+        _z.push_back(data->getRedshift(index));
+        _dataValues.push_back(data->getData(index));
+        if(_type == AbsCorrelationData::Coordinate) {
+            _mu.push_back(data->getCosAngle(index));
+        }
+        else {
+            _multipole.push_back(data->getMultipole(index));
+        }
+    }
+    // Copy the inverse covariance, indexed by offset.
+    likely::CovarianceMatrixCPtr covariance = data->getCovarianceMatrix();
+    if(!covariance) {
+        throw RuntimeError("CorrelationFitter: data has no covariance.");
+    }
+    _icovRowBegin.reserve(nbins+1);
+    _icovRowBegin.push_back(0);
+    _icov.reserve(nbins);
+    std::vector<std::pair<int,int> > elements;
+    if(data->getInverseCovarianceElements(elements)) {
+        // Only look up the elements that the data says might be nonzero, after converting
+        // their global indices to offsets and dropping any that no longer have data.
+        std::vector<std::pair<int,int> > offsets;
+        offsets.reserve(elements.size());
+        for(int k = 0; k < elements.size(); ++k) {
+            int index1(elements[k].first), index2(elements[k].second);
+            if(!data->hasData(index1) || !data->hasData(index2)) continue;
+            int offset1(data->getOffsetForIndex(index1)), offset2(data->getOffsetForIndex(index2));
+            offsets.push_back(offset1 > offset2 ?
+                std::make_pair(offset1,offset2) : std::make_pair(offset2,offset1));
+        }
+        std::sort(offsets.begin(),offsets.end());
+        std::vector<std::pair<int,int> >::const_iterator next(offsets.begin());
+        for(int row = 0; row < nbins; ++row) {
+            for(; next != offsets.end() && next->first == row; ++next) {
+                double value = covariance->getInverseCovariance(row,next->second);
+                if(0 == value) continue;
+                _icovValues.push_back(value);
+                _icovColumns.push_back(next->second);
+            }
+            _icovRowBegin.push_back(_icovValues.size());
+            _icov.push_back(covariance->getInverseCovariance(row,row));
+        }
+    }
+    else {
+        for(int row = 0; row < nbins; ++row) {
+            for(int col = 0; col < row; ++col) {
+                double value = covariance->getInverseCovariance(row,col);
+                if(0 == value) continue;
+                _icovValues.push_back(value);
+                _icovColumns.push_back(col);
+            }
+            _icovRowBegin.push_back(_icovValues.size());
+            _icov.push_back(covariance->getInverseCovariance(row,row));
+        }
+    }
+    // Switch to dense storage unless the matrix is sparse enough that the indirect indexing pays off.
+    _sparse = (_icovValues.size() < maxSparseFill*(nbins*(nbins-1.))/2);
+    if(!_sparse) {
+        std::vector<double> diagonal;
+        diagonal.swap(_icov);
+        _icov.resize((nbins*(nbins+1))/2,0);
+        for(int row = 0; row < nbins; ++row) {
+            double *packed = &_icov[(row*(row+1))/2];
+            for(int k = _icovRowBegin[row]; k < _icovRowBegin[row+1]; ++k) {
+                packed[_icovColumns[k]] = _icovValues[k];
+            }
+            packed[row] = diagonal[row];
+        }
+        std::vector<double>().swap(_icovValues);
+        std::vector<int>().swap(_icovColumns);
+        std::vector<int>().swap(_icovRowBegin);
+    }
+    // Allocate our work buffers now so that operator() never needs to.
+    _prediction.resize(nbins);
+    _residual.resize(nbins);
+    // Divide the bins into one contiguous range per thread, each with its own evaluation context.
+    // We own our contexts so that other fitters sharing our model can never rebind them.
+    if(nthreads > nbins) nthreads = nbins;
+    for(int index = 0; index <= nthreads; ++index) {
+        _rangeBegin.push_back((index*nbins)/nthreads);
+    }
+    for(int index = 0; index < nthreads; ++index) {
+        _contexts.push_back(EvaluationContextPtr(new EvaluationContext()));
+    }
+    _bindRanges();
+    if(nthreads > 1) _workers.reset(new WorkerPool(*this,nthreads));
+}
+
+void local::CorrelationFitter::_bindRanges() {
+    // Precompute per-bin quantities once for our fixed bins.
+    for(int index = 0; index < _contexts.size(); ++index) {
+        int begin(_rangeBegin[index]), n(_rangeBegin[index+1] - begin);
+        if(!_nodeBegin.empty()) {
+            int first(_nodeBegin[begin]), nNodes(_nodeBegin[begin+n] - first);
+            _model->bindRange(nNodes,&_nodeR[first],&_nodeMu[first],&_nodeZ[first],*_contexts[index]);
+        }
+        else if(_type == AbsCorrelationData::Coordinate) {
+            _model->bindRange(n,&_r[begin],&_mu[begin],&_z[begin],*_contexts[index]);
+        }
+        else {
+            _model->bindRange(n,&_r[begin],&_multipole[begin],&_z[begin],*_contexts[index]);
+        }
+    }
+}
+
+void local::CorrelationFitter::setBinIntegration(int order) {
+    if(order < 1) {
+        throw RuntimeError("CorrelationFitter::setBinIntegration: expected order >= 1.");
+    }
+    if(order > 1 && _type != AbsCorrelationData::Coordinate) {
+        throw RuntimeError("CorrelationFitter::setBinIntegration: bin integration needs (r,mu) binned data.");
+    }
+    _nodeR.resize(0);
+    _nodeMu.resize(0);
+    _nodeZ.resize(0);
+    _nodeWeight.resize(0);
+    _nodeBegin.resize(0);
+    if(order > 1) {
+        // Tabulate the quadrature nodes of each bin, in the same order as our bins.
+        std::vector<double> r, mu, z, weight;
+        _nodeBegin.push_back(0);
+        for(AbsCorrelationData::IndexIterator iter = _data->begin(); iter != _data->end(); ++iter) {
+            _data->getBinQuadrature(*iter,order,r,mu,z,weight);
+            _nodeR.insert(_nodeR.end(),r.begin(),r.end());
+            _nodeMu.insert(_nodeMu.end(),mu.begin(),mu.end());
+            _nodeZ.insert(_nodeZ.end(),z.begin(),z.end());
+            _nodeWeight.insert(_nodeWeight.end(),weight.begin(),weight.end());
+            _nodeBegin.push_back(_nodeR.size());
+        }
+    }
+    _nodePrediction.resize(_nodeR.size());
+    _bindRanges();
+    // Any cached values were calculated with the old predictions.
+    if(_cache) _cache->clear();
 }
 
 local::CorrelationFitter::~CorrelationFitter() { }
@@ -34,51 +344,699 @@ void local::CorrelationFitter::setErrorScale(double scale) {
         throw RuntimeError("CorrelationFitter::setErrorScale: expected scale > 0.");
     }
     _errorScale = scale;
+    // Any cached values were calculated with the old scale.
+    if(_cache) _cache->clear();
+}
+
+void local::CorrelationFitter::setLikelihoodCacheSize(int size) {
+    if(size < 0) {
+        throw RuntimeError("CorrelationFitter::setLikelihoodCacheSize: expected size >= 0.");
+    }
+    if(0 == size) {
+        _cache.reset();
+    }
+    else {
+        _cache.reset(new LikelihoodCache(size));
+    }
+}
+
+void local::CorrelationFitter::getLikelihoodCacheStatistics(long &nHits, long &nMisses) const {
+    nHits = _cache ? _cache->nHits : 0;
+    nMisses = _cache ? _cache->nMisses : 0;
+}
+
+void local::CorrelationFitter::setAnalyticLinearParameters(bool value) {
+    _analyticLinear = value;
+}
+
+void local::CorrelationFitter::setProfile(FitProfilePtr profile) {
+    _profile = profile;
 }
 
 void local::CorrelationFitter::getPrediction(likely::Parameters const &params,
 std::vector<double> &prediction) const {
-    prediction.reserve(_data->getNBinsWithData());
-    prediction.resize(0);
-    for(baofit::AbsCorrelationData::IndexIterator iter = _data->begin(); iter != _data->end(); ++iter) {
-        int index(*iter);
-        double z = _data->getRedshift(index);
-        double r = _data->getRadius(index);
-        double predicted;
-        if(_type == AbsCorrelationData::Coordinate) {
-            double mu = _data->getCosAngle(index);
-            predicted = _model->evaluate(r,mu,z,params);
+    FitProfile::Timer timer(_profile.get(),FitProfile::Prediction);
+    prediction.resize(_r.size());
+    // Evaluate the model for all bins, splitting them between our threads.
+    _model->beginEvaluation(params);
+    if(_workers) {
+        _workers->run(&prediction[0]);
+    }
+    else {
+        _evaluateRange(0,&prediction[0]);
+    }
+    _model->endEvaluation();
+}
+
+void local::CorrelationFitter::_evaluateRange(int index, double *prediction) const {
+    int begin(_rangeBegin[index]), n(_rangeBegin[index+1] - begin);
+    if(!_nodeBegin.empty()) {
+        // Evaluate the model at the nodes of this range in one batch, then average over each bin.
+        int first(_nodeBegin[begin]), nNodes(_nodeBegin[begin+n] - first), totalNodes(_nodeR.size());
+        _model->evaluateRange(nNodes,&_nodeR[first],&_nodeMu[first],&_nodeZ[first],&_nodePrediction[first],
+            *_contexts[index]);
+        for(int i = begin; i < begin + n; ++i) {
+            double sum(0);
+            for(int j = _nodeBegin[i]; j < _nodeBegin[i+1]; ++j) sum += _nodeWeight[j]*_nodePrediction[j];
+            prediction[i] = sum;
         }
-        else {
-            cosmo::Multipole multipole = _data->getMultipole(index);
-            predicted = _model->evaluate(r,multipole,z,params);
+        if(_solveLinear) {
+            int nbins(_r.size()), nlinear(_basis.size()/nbins);
+            _model->evaluateLinearBasis(nNodes,&_nodeR[first],&_nodeMu[first],&_nodeZ[first],
+                &_nodeBasis[first],totalNodes,*_contexts[index]);
+            for(int k = 0; k < nlinear; ++k) {
+                double const *nodeColumn = &_nodeBasis[k*totalNodes];
+                double *column = &_basis[k*nbins];
+                for(int i = begin; i < begin + n; ++i) {
+                    double sum(0);
+                    for(int j = _nodeBegin[i]; j < _nodeBegin[i+1]; ++j) sum += _nodeWeight[j]*nodeColumn[j];
+                    column[i] = sum;
+                }
+            }
         }
-        prediction.push_back(predicted);
-    }    
+    }
+    else if(_type == AbsCorrelationData::Coordinate) {
+        _model->evaluateRange(n,&_r[begin],&_mu[begin],&_z[begin],prediction+begin,*_contexts[index]);
+        if(_solveLinear) {
+            _model->evaluateLinearBasis(n,&_r[begin],&_mu[begin],&_z[begin],&_basis[begin],
+                _r.size(),*_contexts[index]);
+        }
+    }
+    else {
+        _model->evaluateRange(n,&_r[begin],&_multipole[begin],&_z[begin],prediction+begin,*_contexts[index]);
+    }
+}
+
+double local::CorrelationFitter::_chiSquare(std::vector<double> const &delta) const {
+    int nbins(delta.size());
+    double const *d = &delta[0];
+    double chi2(0);
+    if(_sparse) {
+        for(int i = 0; i < nbins; ++i) {
+            // Accumulate the off-diagonal elements of this row, which appear twice by symmetry.
+            double sum(0);
+            for(int k = _icovRowBegin[i]; k < _icovRowBegin[i+1]; ++k) sum += _icovValues[k]*d[_icovColumns[k]];
+            chi2 += d[i]*(2*sum + _icov[i]*d[i]);
+        }
+        return chi2;
+    }
+    double const *row = &_icov[0];
+    for(int i = 0; i < nbins; ++i) {
+        // Accumulate the off-diagonal elements of this row, which appear twice by symmetry.
+        double sum(0);
+        for(int j = 0; j < i; ++j) sum += row[j]*d[j];
+        chi2 += d[i]*(2*sum + row[i]*d[i]);
+        row += i+1;
+    }
+    return chi2;
+}
+
+void local::CorrelationFitter::_multiplyInverseCovariance(double const *v, double *result) const {
+    int nbins(_dataValues.size());
+    if(_sparse) {
+        for(int i = 0; i < nbins; ++i) {
+            // Each off-diagonal element of this row contributes to both result[i] and result[j].
+            double sum(0), vi(v[i]);
+            for(int k = _icovRowBegin[i]; k < _icovRowBegin[i+1]; ++k) {
+                int j(_icovColumns[k]);
+                sum += _icovValues[k]*v[j];
+                result[j] += _icovValues[k]*vi;
+            }
+            result[i] = sum + _icov[i]*vi;
+        }
+        return;
+    }
+    double const *row = &_icov[0];
+    for(int i = 0; i < nbins; ++i) {
+        // Each off-diagonal element of this row contributes to both result[i] and result[j].
+        double sum(0), vi(v[i]);
+        for(int j = 0; j < i; ++j) {
+            sum += row[j]*v[j];
+            result[j] += row[j]*vi;
+        }
+        result[i] = sum + row[i]*vi;
+        row += i+1;
+    }
 }
 
 double local::CorrelationFitter::operator()(likely::Parameters const &params) const {
+    if(!_cache) return _evaluate(params);
+    // Look for this exact parameter vector in our cache.
+    double value;
+    bool found = _cache->find(params,value);
+    if(_profile) _profile->addTerm("likelihood",found);
+    if(found) return value;
+    value = _evaluate(params);
+    _cache->add(params,value);
+    return value;
+}
+
+double local::CorrelationFitter::_evaluate(likely::Parameters const &params) const {
     // Check that we have the expected number of parameters.
     if(params.size() != _model->getNParameters()) {
         throw RuntimeError("CorrelationFitter: got unexpected number of parameters.");
     }
-    // Calculate the prediction vector for these parameter values.
-    std::vector<double> pred;
-    getPrediction(params,pred);
+    if(_profile) _profile->addEvaluation();
+    if(_solveLinear) return _evaluateAnalyticLinear(params);
+    // Calculate the prediction vector for these parameter values in our work buffer.
+    getPrediction(params,_prediction);
+    double chi2, priors;
+    {
+        FitProfile::Timer timer(_profile.get(),FitProfile::ChiSquare);
+        // Calculate the residuals (data - prediction) in our other work buffer.
+        int nbins(_dataValues.size());
+        for(int offset = 0; offset < nbins; ++offset) {
+            _residual[offset] = _dataValues[offset] - _prediction[offset];
+        }
+        chi2 = _chiSquare(_residual);
+    }
+    {
+        FitProfile::Timer timer(_profile.get(),FitProfile::Priors);
+        priors = _model->evaluatePriors();
+    }
     // Scale chiSquare by 0.5 since the likely minimizer expects a -log(likelihood).
     // Add any model priors on the parameters. The additional factor of _errorScale
     // is to allow arbitrary error contours to be calculated a la MNCONTOUR.
-    return (0.5*_data->chiSquare(pred) + _model->evaluatePriors())/_errorScale;
+    return (0.5*chi2 + priors)/_errorScale;
+}
+
+namespace baofit {
+    // Solves L.L^t.x = b for x, where a holds L in its lower triangle (stored in row-major order)
+    // as calculated by choleskySolve. Overwrites b with x.
+    void choleskySubstitute(int n, double const *a, double *b) {
+        // Solve L.y = b then L^t.x = y.
+        for(int i = 0; i < n; ++i) {
+            double sum = b[i];
+            for(int k = 0; k < i; ++k) sum -= a[i*n+k]*b[k];
+            b[i] = sum/a[i*n+i];
+        }
+        for(int i = n-1; i >= 0; --i) {
+            double sum = b[i];
+            for(int k = i+1; k < n; ++k) sum -= a[k*n+i]*b[k];
+            b[i] = sum/a[i*n+i];
+        }
+    }
+    // Solves a*x = b for x, where a is an n x n symmetric positive definite matrix stored in row-major
+    // order, using a Cholesky decomposition. Overwrites a with its decomposition and b with x.
+    // Returns false if a is not positive definite.
+    bool choleskySolve(int n, double *a, double *b) {
+        // Decompose a = L.L^t in place (lower triangle).
+        for(int j = 0; j < n; ++j) {
+            double diag = a[j*n+j];
+            for(int k = 0; k < j; ++k) diag -= a[j*n+k]*a[j*n+k];
+            if(!(diag > 0)) return false;
+            diag = std::sqrt(diag);
+            a[j*n+j] = diag;
+            for(int i = j+1; i < n; ++i) {
+                double sum = a[i*n+j];
+                for(int k = 0; k < j; ++k) sum -= a[i*n+k]*a[j*n+k];
+                a[i*n+j] = sum/diag;
+            }
+        }
+        choleskySubstitute(n,a,b);
+        return true;
+    }
+    // Calculates the inverse of a matrix from the decomposition stored in a by choleskySolve,
+    // and saves it in row-major order.
+    void choleskyInvert(int n, double const *a, double *inverse) {
+        std::vector<double> column(n);
+        for(int j = 0; j < n; ++j) {
+            for(int i = 0; i < n; ++i) column[i] = (i == j) ? 1 : 0;
+            choleskySubstitute(n,a,&column[0]);
+            for(int i = 0; i < n; ++i) inverse[i*n+j] = column[i];
+        }
+    }
+}
+
+double local::CorrelationFitter::_evaluateAnalyticLinear(likely::Parameters const &params) const {
+    // Calculate the prediction and the linear basis vectors for these parameter values.
+    getPrediction(params,_prediction);
+    int nbins(_dataValues.size()), nlinear(_linearIndices.size());
+    {
+        FitProfile::Timer timer(_profile.get(),FitProfile::LinearSolve);
+        // Calculate the residuals with the linear parameter contributions removed.
+        for(int i = 0; i < nbins; ++i) _residual[i] = _dataValues[i] - _prediction[i];
+        for(int k = 0; k < nlinear; ++k) {
+            double value(params[_linearIndices[k]]);
+            if(0 == value) continue;
+            double const *column = &_basis[_linearColumns[k]*nbins];
+            for(int i = 0; i < nbins; ++i) _residual[i] += value*column[i];
+        }
+        // Build the normal equations for the weighted least-squares solution, including any priors.
+        for(int k1 = 0; k1 < nlinear; ++k1) {
+            double *weighted = &_weightedBasis[k1*nbins];
+            _multiplyInverseCovariance(&_basis[_linearColumns[k1]*nbins],weighted);
+            double sum(0);
+            for(int i = 0; i < nbins; ++i) sum += weighted[i]*_residual[i];
+            _solution[k1] = sum + _priorCurvature[k1]*_priorCenter[k1];
+            for(int k2 = 0; k2 <= k1; ++k2) {
+                double const *column = &_basis[_linearColumns[k2]*nbins];
+                sum = 0;
+                for(int i = 0; i < nbins; ++i) sum += weighted[i]*column[i];
+                _normal[k1*nlinear+k2] = _normal[k2*nlinear+k1] = sum;
+            }
+            _normal[k1*nlinear+k1] += _priorCurvature[k1];
+        }
+        if(!choleskySolve(nlinear,&_normal[0],&_solution[0])) {
+            throw RuntimeError("CorrelationFitter: linear parameters are not constrained by the data.");
+        }
+        // Calculate the residuals using the solved linear parameter values.
+        for(int k = 0; k < nlinear; ++k) {
+            double const *column = &_basis[_linearColumns[k]*nbins];
+            for(int i = 0; i < nbins; ++i) _residual[i] -= _solution[k]*column[i];
+        }
+    }
+    double chi2, priors;
+    {
+        FitProfile::Timer timer(_profile.get(),FitProfile::ChiSquare);
+        chi2 = _chiSquare(_residual);
+    }
+    {
+        // Evaluate the priors using the solved linear parameter values.
+        FitProfile::Timer timer(_profile.get(),FitProfile::Priors);
+        _linearParams = params;
+        for(int k = 0; k < nlinear; ++k) _linearParams[_linearIndices[k]] = _solution[k];
+        _model->beginEvaluation(_linearParams);
+        priors = _model->evaluatePriors();
+        _model->endEvaluation();
+    }
+    return (0.5*chi2 + priors)/_errorScale;
+}
+
+void local::CorrelationFitter::_setSolveLinear(bool value) const {
+    _solveLinear = value;
+    // Our likelihood is a different function of the parameters when we solve for linear ones.
+    if(_cache) _cache->clear();
 }
 
 likely::FunctionMinimumPtr local::CorrelationFitter::fit(std::string const &methodName,
 std::string const &config) const {
-    likely::FunctionPtr fptr(new likely::Function(*this));
+    // Prepare to profile this fit, if requested, using a separate profile for each context.
+    std::vector<FitProfilePtr> contextProfiles;
+    double start(0);
+    if(_profile) {
+        _profile->reset();
+        for(int index = 0; index < _contexts.size(); ++index) {
+            contextProfiles.push_back(FitProfilePtr(new FitProfile()));
+            _contexts[index]->setProfile(contextProfiles.back());
+        }
+        start = FitProfile::getWallTime();
+    }
+    likely::FunctionMinimumPtr fmin;
+    if(_analyticLinear && methodName != "baofit::lm" && !_model->getLinearParameterIndices().empty()) {
+        fmin = _fitAnalyticLinear(methodName,config);
+    }
+    else {
+        fmin = _fit(methodName,config);
+    }
+    if(_profile) {
+        _profile->addFitTime(FitProfile::getWallTime() - start);
+        for(int index = 0; index < _contexts.size(); ++index) {
+            _profile->add(*contextProfiles[index]);
+            _contexts[index]->setProfile(FitProfilePtr());
+        }
+    }
+    return fmin;
+}
+
+likely::FunctionMinimumPtr local::CorrelationFitter::_fit(std::string const &methodName,
+std::string const &config) const {
+    if(methodName == "baofit::lm") return _fitLevenbergMarquardt(config);
+    likely::FunctionPtr fptr(new likely::Function(boost::cref(*this)));
     return _model->findMinimum(fptr,methodName,config);
 }
 
+likely::FunctionMinimumPtr local::CorrelationFitter::_fitAnalyticLinear(std::string const &methodName,
+std::string const &config) const {
+    // Lookup our initial parameter configuration.
+    likely::FunctionPtr fptr(new likely::Function(boost::cref(*this)));
+    likely::FitParameters fitParams(_model->guessMinimum(fptr)->getFitParameters());
+    if(config.length() > 0) likely::modifyFitParameters(fitParams,config);
+    // Find which linear parameters are floating in this fit.
+    std::vector<int> const &linear = _model->getLinearParameterIndices();
+    _linearIndices.resize(0);
+    _linearColumns.resize(0);
+    for(int k = 0; k < linear.size(); ++k) {
+        if(!fitParams[linear[k]].isFloating()) continue;
+        _linearIndices.push_back(linear[k]);
+        _linearColumns.push_back(k);
+    }
+    int nlinear(_linearIndices.size()), nbins(_dataValues.size());
+    if(0 == nlinear) return _fit(methodName,config);
+    // Multipole data is fit numerically (src/baofit.cc rejects this combination up front).
+    if(_type != AbsCorrelationData::Coordinate) return _fit(methodName,config);
+    _basis.resize(linear.size()*nbins);
+    _nodeBasis.resize(linear.size()*_nodeR.size());
+    _weightedBasis.resize(nlinear*nbins);
+    _normal.resize(nlinear*nlinear);
+    _solution.resize(nlinear);
+    _priorCurvature.resize(nlinear);
+    _priorCenter.resize(nlinear);
+    // Approximate any prior on each linear parameter as a quadratic, using central differences
+    // around its initial value. This is only valid for Gaussian priors, so we check that differences
+    // over twice the step size give the same quadratic.
+    double const quadraticTolerance(1e-6);
+    likely::Parameters params(fitParams.size());
+    for(int ipar = 0; ipar < fitParams.size(); ++ipar) params[ipar] = fitParams[ipar].getValue();
+    _model->beginEvaluation(params);
+    double prior0 = _model->evaluatePriors();
+    _model->endEvaluation();
+    for(int k = 0; k < nlinear; ++k) {
+        int ipar(_linearIndices[k]);
+        double value(params[ipar]), step(fitParams[ipar].getError());
+        if(step <= 0) step = 1;
+        double priors[4];
+        for(int i = 0; i < 4; ++i) {
+            // Evaluates at value + step*(-2,-1,+1,+2)
+            params[ipar] = value + step*(i < 2 ? i-2 : i-1);
+            _model->beginEvaluation(params);
+            priors[i] = _model->evaluatePriors();
+            _model->endEvaluation();
+        }
+        params[ipar] = value;
+        double diff1(priors[2] - priors[1]), diff2(priors[3] - priors[0]);
+        double curv1(priors[2] - 2*prior0 + priors[1]), curv2(priors[3] - 2*prior0 + priors[0]);
+        double scale(1 + std::fabs(priors[0]) + std::fabs(priors[3]));
+        if(std::fabs(diff2 - 2*diff1) > quadraticTolerance*scale ||
+        std::fabs(curv2 - 4*curv1) > quadraticTolerance*scale) {
+            throw RuntimeError("CorrelationFitter: analytic linear parameters only support Gaussian priors (" +
+                fitParams[ipar].getName() + " has a non-Gaussian prior).");
+        }
+        double curvature = curv1/(step*step);
+        if(curvature > 0) {
+            _priorCurvature[k] = curvature;
+            _priorCenter[k] = value - diff1/(2*step*curvature);
+        }
+        else {
+            _priorCurvature[k] = _priorCenter[k] = 0;
+        }
+    }
+    // Fix the linear parameters for the minimizer, since we solve for them ourselves.
+    std::string fixConfig(config);
+    boost::format fixParam("fix[%s]=%.12g");
+    for(int k = 0; k < nlinear; ++k) {
+        likely::FitParameter const &fitParam = fitParams[_linearIndices[k]];
+        if(fixConfig.length() > 0) fixConfig += "; ";
+        fixConfig += boost::str(fixParam % fitParam.getName() % fitParam.getValue());
+    }
+    likely::FunctionMinimumPtr fmin;
+    likely::Parameters bestValues, solvedValues;
+    std::vector<double> solved, linearCovariance(nlinear*nlinear);
+    std::vector<int> floating;
+    std::vector<double> derivatives;
+    _setSolveLinear(true);
+    try {
+        fmin = _fit(methodName,fixConfig);
+        // Solve for the linear parameters at the minimum and save the inverse of their normal
+        // matrix, which is their covariance at fixed values of the other parameters.
+        bestValues = fmin->getParameters();
+        _evaluate(bestValues);
+        solved = _solution;
+        solvedValues = _linearParams;
+        choleskyInvert(nlinear,&_normal[0],&linearCovariance[0]);
+        // Estimate the derivatives of the solved values with respect to each floating parameter,
+        // using central differences with steps equal to the parameter errors.
+        likely::FitParameters minParams(fmin->getFitParameters());
+        likely::Parameters errors(fmin->getErrors());
+        for(int ipar = 0; ipar < minParams.size(); ++ipar) {
+            if(minParams[ipar].isFloating()) floating.push_back(ipar);
+        }
+        int nfloat(floating.size());
+        derivatives.resize(nlinear*nfloat,0);
+        for(int j = 0; j < nfloat; ++j) {
+            int ipar(floating[j]);
+            double step(errors[ipar]);
+            if(!(step > 0)) continue;
+            params = bestValues;
+            params[ipar] = bestValues[ipar] + step;
+            _evaluate(params);
+            std::vector<double> plus(_solution);
+            params[ipar] = bestValues[ipar] - step;
+            _evaluate(params);
+            for(int k = 0; k < nlinear; ++k) {
+                derivatives[k*nfloat+j] = (plus[k] - _solution[k])/(2*step);
+            }
+        }
+    }
+    catch(...) {
+        _setSolveLinear(false);
+        throw;
+    }
+    _setSolveLinear(false);
+    // Check that our quadratic prior approximation holds between the initial and solved values,
+    // which catches solutions that wander outside a flat (box) prior.
+    _model->beginEvaluation(solvedValues);
+    double solvedPrior = _model->evaluatePriors();
+    _model->endEvaluation();
+    _model->beginEvaluation(bestValues);
+    double initialPrior = _model->evaluatePriors();
+    _model->endEvaluation();
+    double quadraticChange(0);
+    for(int k = 0; k < nlinear; ++k) {
+        double before(bestValues[_linearIndices[k]] - _priorCenter[k]), after(solved[k] - _priorCenter[k]);
+        quadraticChange += 0.5*_priorCurvature[k]*(after*after - before*before);
+    }
+    bool priorsOk(std::fabs(solvedPrior - initialPrior - quadraticChange) <=
+        quadraticTolerance*(1 + std::fabs(solvedPrior) + std::fabs(initialPrior)));
+    // Report the linear parameters as floating at their solved values.
+    likely::FitParameters bestParams(fmin->getFitParameters());
+    for(int k = 0; k < nlinear; ++k) {
+        int ipar(_linearIndices[k]);
+        bestParams[ipar].release();
+        bestParams[ipar].setValue(solved[k]);
+    }
+    // Lookup the position of each floating parameter in the combined covariance matrix.
+    std::vector<int> position(bestParams.size(),-1);
+    int ncombined(0);
+    for(int ipar = 0; ipar < bestParams.size(); ++ipar) {
+        if(bestParams[ipar].isFloating()) position[ipar] = ncombined++;
+    }
+    likely::FunctionMinimumPtr result;
+    likely::CovarianceMatrixCPtr minCovariance(fmin->getCovariance());
+    if(minCovariance) {
+        // The minimizer's covariance is already marginalized over the linear parameters. Propagate
+        // it to the solved values, whose derivatives D give Cov(lin,other) = D.C and
+        // Cov(lin,lin) = N^-1 + D.C.D^t, where N is the normal matrix.
+        int nfloat(floating.size());
+        std::vector<double> cross(nlinear*nfloat,0);
+        for(int k = 0; k < nlinear; ++k) {
+            for(int j1 = 0; j1 < nfloat; ++j1) {
+                double sum(0);
+                for(int j2 = 0; j2 < nfloat; ++j2) {
+                    sum += derivatives[k*nfloat+j2]*minCovariance->getCovariance(j2,j1);
+                }
+                cross[k*nfloat+j1] = sum;
+            }
+        }
+        likely::CovarianceMatrixPtr covariance(new likely::CovarianceMatrix(ncombined));
+        for(int j1 = 0; j1 < nfloat; ++j1) {
+            for(int j2 = 0; j2 <= j1; ++j2) {
+                covariance->setCovariance(position[floating[j1]],position[floating[j2]],
+                    minCovariance->getCovariance(j1,j2));
+            }
+        }
+        for(int k1 = 0; k1 < nlinear; ++k1) {
+            int pos1(position[_linearIndices[k1]]);
+            for(int j = 0; j < nfloat; ++j) {
+                covariance->setCovariance(pos1,position[floating[j]],cross[k1*nfloat+j]);
+            }
+            for(int k2 = 0; k2 <= k1; ++k2) {
+                double sum(_errorScale*linearCovariance[k1*nlinear+k2]);
+                for(int j = 0; j < nfloat; ++j) sum += cross[k1*nfloat+j]*derivatives[k2*nfloat+j];
+                covariance->setCovariance(pos1,position[_linearIndices[k2]],sum);
+            }
+            bestParams[_linearIndices[k1]].setError(std::sqrt(covariance->getCovariance(pos1,pos1)));
+        }
+        result.reset(new likely::FunctionMinimum(fmin->getMinValue(),bestParams,covariance));
+    }
+    else {
+        for(int k = 0; k < nlinear; ++k) {
+            bestParams[_linearIndices[k]].setError(std::sqrt(_errorScale*linearCovariance[k*nlinear+k]));
+        }
+        result.reset(new likely::FunctionMinimum(fmin->getMinValue(),bestParams));
+    }
+    if(fmin->getStatus() != likely::FunctionMinimum::OK) {
+        result->setStatus(fmin->getStatus(),"CorrelationFitter: fit with analytic linear parameters failed.");
+    }
+    else if(!priorsOk) {
+        result->setStatus(likely::FunctionMinimum::WARNING,
+            "CorrelationFitter: solved linear parameters are outside the range where their priors are Gaussian.");
+    }
+    return result;
+}
+
+likely::FunctionMinimumPtr local::CorrelationFitter::_fitLevenbergMarquardt(std::string const &config) const {
+    // Convergence and iteration limits.
+    double const edmGoal(1e-5), lambdaMin(1e-9), lambdaMax(1e10);
+    int const maxIterations(200);
+    // Lookup our initial parameter configuration.
+    likely::FunctionPtr fptr(new likely::Function(boost::cref(*this)));
+    likely::FitParameters fitParams(_model->guessMinimum(fptr)->getFitParameters());
+    if(config.length() > 0) likely::modifyFitParameters(fitParams,config);
+    int npar(fitParams.size()), nbins(_dataValues.size());
+    likely::Parameters params(npar);
+    std::vector<int> floating;
+    std::vector<double> steps;
+    for(int ipar = 0; ipar < npar; ++ipar) {
+        params[ipar] = fitParams[ipar].getValue();
+        if(!fitParams[ipar].isFloating()) continue;
+        floating.push_back(ipar);
+        // Use a small fraction of each parameter's initial error for numerical derivatives.
+        double error = fitParams[ipar].getError();
+        if(error <= 0) error = std::fabs(params[ipar]) > 0 ? std::fabs(params[ipar]) : 1;
+        steps.push_back(1e-3*error);
+    }
+    int nfloat(floating.size());
+    if(0 == nfloat) throw RuntimeError("CorrelationFitter: no floating parameters to fit.");
+    // Evaluate our starting point.
+    double fval = _evaluate(params);
+    std::vector<double> prediction(_prediction), jacobian(nfloat*nbins), weighted(nfloat*nbins);
+    std::vector<double> hessian(nfloat*nfloat), gradient(nfloat), step(nfloat), trial;
+    double lambda(1e-3), edm(0);
+    bool converged(false), failed(false);
+    for(int iteration = 0; iteration <= maxIterations && !failed; ++iteration) {
+        // Calculate the Jacobian of our prediction using forward differences.
+        for(int k = 0; k < nfloat; ++k) {
+            trial = params;
+            trial[floating[k]] += steps[k];
+            getPrediction(trial,_residual);
+            double *column = &jacobian[k*nbins];
+            for(int i = 0; i < nbins; ++i) column[i] = (_residual[i] - prediction[i])/steps[k];
+            // Calculate Cinv.J for this column.
+            _multiplyInverseCovariance(column,&weighted[k*nbins]);
+        }
+        // Calculate the Gauss-Newton Hessian J.Cinv.J and the gradient J.Cinv.(data - prediction)
+        // of -chiSquare/2.
+        for(int k1 = 0; k1 < nfloat; ++k1) {
+            double const *w1 = &weighted[k1*nbins];
+            double sum(0);
+            for(int i = 0; i < nbins; ++i) sum += w1[i]*(_dataValues[i] - prediction[i]);
+            gradient[k1] = sum;
+            for(int k2 = 0; k2 <= k1; ++k2) {
+                double const *j2 = &jacobian[k2*nbins];
+                sum = 0;
+                for(int i = 0; i < nbins; ++i) sum += w1[i]*j2[i];
+                hessian[k1*nfloat+k2] = hessian[k2*nfloat+k1] = sum;
+            }
+        }
+        // Add the prior contributions using central differences, including mixed differences for
+        // each pair of parameters that both change the priors, so that priors on combinations of
+        // parameters are handled correctly.
+        _model->beginEvaluation(params);
+        double prior0 = _model->evaluatePriors();
+        _model->endEvaluation();
+        std::vector<int> constrained;
+        for(int k = 0; k < nfloat; ++k) {
+            trial = params;
+            trial[floating[k]] += steps[k];
+            _model->beginEvaluation(trial);
+            double priorPlus = _model->evaluatePriors();
+            _model->endEvaluation();
+            trial[floating[k]] -= 2*steps[k];
+            _model->beginEvaluation(trial);
+            double priorMinus = _model->evaluatePriors();
+            _model->endEvaluation();
+            gradient[k] -= (priorPlus - priorMinus)/(2*steps[k]);
+            hessian[k*nfloat+k] += (priorPlus - 2*prior0 + priorMinus)/(steps[k]*steps[k]);
+            if(priorPlus != prior0 || priorMinus != prior0) constrained.push_back(k);
+        }
+        for(int c1 = 0; c1 < constrained.size(); ++c1) {
+            int k1(constrained[c1]);
+            for(int c2 = 0; c2 < c1; ++c2) {
+                int k2(constrained[c2]);
+                // Evaluate the priors at the corners (+,+), (-,+), (+,-) and (-,-).
+                double corners[4];
+                for(int corner = 0; corner < 4; ++corner) {
+                    trial = params;
+                    trial[floating[k1]] += (corner & 1) ? -steps[k1] : steps[k1];
+                    trial[floating[k2]] += (corner & 2) ? -steps[k2] : steps[k2];
+                    _model->beginEvaluation(trial);
+                    corners[corner] = _model->evaluatePriors();
+                    _model->endEvaluation();
+                }
+                double mixed = (corners[0] - corners[1] - corners[2] + corners[3])/(4*steps[k1]*steps[k2]);
+                hessian[k1*nfloat+k2] += mixed;
+                hessian[k2*nfloat+k1] += mixed;
+            }
+        }
+        // Check for convergence using the estimated distance to the minimum.
+        likely::CovarianceMatrix newton(nfloat);
+        for(int k1 = 0; k1 < nfloat; ++k1) {
+            for(int k2 = 0; k2 <= k1; ++k2) newton.setInverseCovariance(k1,k2,hessian[k1*nfloat+k2]);
+        }
+        if(newton.isPositiveDefinite()) {
+            edm = 0;
+            for(int k1 = 0; k1 < nfloat; ++k1) {
+                for(int k2 = 0; k2 < nfloat; ++k2) {
+                    edm += 0.5*gradient[k1]*newton.getCovariance(k1,k2)*gradient[k2];
+                }
+            }
+            if(edm/_errorScale < edmGoal) {
+                converged = true;
+                break;
+            }
+        }
+        if(iteration == maxIterations) break;
+        // Try damped steps until we find one that improves our likelihood.
+        while(true) {
+            likely::CovarianceMatrix damped(nfloat);
+            for(int k1 = 0; k1 < nfloat; ++k1) {
+                for(int k2 = 0; k2 < k1; ++k2) damped.setInverseCovariance(k1,k2,hessian[k1*nfloat+k2]);
+                damped.setInverseCovariance(k1,k1,(1+lambda)*hessian[k1*nfloat+k1]);
+            }
+            if(damped.isPositiveDefinite()) {
+                trial = params;
+                for(int k1 = 0; k1 < nfloat; ++k1) {
+                    double delta(0);
+                    for(int k2 = 0; k2 < nfloat; ++k2) delta += damped.getCovariance(k1,k2)*gradient[k2];
+                    trial[floating[k1]] += delta;
+                }
+                double ftrial = _evaluate(trial);
+                if(ftrial < fval) {
+                    // Accept this step and try less damping next time.
+                    params = trial;
+                    fval = ftrial;
+                    prediction = _prediction;
+                    lambda = std::max(lambdaMin,lambda/10);
+                    break;
+                }
+            }
+            lambda *= 10;
+            if(lambda > lambdaMax) {
+                failed = true;
+                break;
+            }
+        }
+    }
+    // Build the function minimum, using the inverse of our final Hessian estimate (scaled to
+    // match our likelihood normalization) as the parameter covariance.
+    likely::CovarianceMatrixPtr covariance(new likely::CovarianceMatrix(nfloat));
+    for(int k1 = 0; k1 < nfloat; ++k1) {
+        for(int k2 = 0; k2 <= k1; ++k2) {
+            covariance->setInverseCovariance(k1,k2,hessian[k1*nfloat+k2]/_errorScale);
+        }
+    }
+    for(int ipar = 0; ipar < npar; ++ipar) fitParams[ipar].setValue(params[ipar]);
+    likely::FunctionMinimumPtr fmin;
+    if(covariance->isPositiveDefinite()) {
+        for(int k = 0; k < nfloat; ++k) {
+            fitParams[floating[k]].setError(std::sqrt(covariance->getCovariance(k,k)));
+        }
+        fmin.reset(new likely::FunctionMinimum(fval,fitParams,covariance));
+    }
+    else {
+        fmin.reset(new likely::FunctionMinimum(fval,fitParams));
+        converged = false;
+    }
+    if(!converged) {
+        fmin->setStatus(likely::FunctionMinimum::WARNING,
+            "CorrelationFitter: Levenberg-Marquardt fit did not converge.");
+    }
+    return fmin;
+}
+
 likely::FunctionMinimumPtr local::CorrelationFitter::guess() const {
-    likely::FunctionPtr fptr(new likely::Function(*this));
+    likely::FunctionPtr fptr(new likely::Function(boost::cref(*this)));
     return _model->guessMinimum(fptr);
 }
 
@@ -94,7 +1052,7 @@ namespace baofit {
 
 void local::CorrelationFitter::mcmc(likely::FunctionMinimumCPtr fminStart, int nchain, int interval,
 std::vector<double> &samples) const {
-    likely::FunctionPtr fptr(new likely::Function(*this));
+    likely::FunctionPtr fptr(new likely::Function(boost::cref(*this)));
     // Use a non-const copy of the input function minimum since the generate method below wants to
     // update it (but we will ignore the updates).
     likely::FunctionMinimumPtr fmin(new likely::FunctionMinimum(*fminStart));
@@ -7,25 +7,62 @@
 #include "baofit/types.h"
 #include "likely/types.h"
 
+#include "cosmo/types.h"
+
+#include "boost/smart_ptr.hpp"
+
 #include <vector>
 
 namespace baofit {
 	class CorrelationFitter {
 	// Manages a correlation function fit.
 	public:
-	    // Creates a new fitter for the specified data and model.
-		CorrelationFitter(AbsCorrelationDataCPtr data, AbsCorrelationModelPtr model);
+	    // Creates a new fitter for the specified data and model. Model predictions will be
+	    // calculated using nthreads concurrent threads, each evaluating a different range of bins.
+		CorrelationFitter(AbsCorrelationDataCPtr data, AbsCorrelationModelPtr model, int nthreads = 1);
 		virtual ~CorrelationFitter();
 		// Changes the error scale definition. The default value of 1 corresponds to the
 		// usual 1-sigma errors.
         void setErrorScale(double scale);
+        // Solves for the values of any floating parameters that the model depends on linearly
+        // (e.g., broadband distortion coefficients) with each likelihood evaluation during fit(),
+        // so that the minimizer only sees the remaining parameters. The returned minimum reports
+        // the linear parameters as floating at their solved values, with errors and covariances
+        // propagated from the normal equations, and the errors of the other parameters include the
+        // effects of marginalizing over them. Only Gaussian priors on the linear parameters are
+        // supported. Has no effect with multipole data or the "baofit::lm" method, which already
+        // handles linear parameters efficiently.
+        void setAnalyticLinearParameters(bool value);
+        // Remembers the likelihood values returned by operator() for up to size distinct parameter
+        // vectors, discarding the least recently used value when full, so that minimizers and error
+        // analyses that revisit the exact same point do not need to recalculate it. A size of zero
+        // (the default) disables caching. Any previously cached values and statistics are discarded.
+        void setLikelihoodCacheSize(int size);
+        // Averages the model prediction for each bin over its extent using order x order quadrature
+        // nodes provided by the data's getBinQuadrature(), instead of evaluating the model once at
+        // each bin's coordinates, which is what an order of 1 (the default) does. The nodes are
+        // calculated once here, and each prediction then costs about order^2 point evaluations.
+        // Requires (r,mu) binned data when order > 1.
+        void setBinIntegration(int order);
+        // Fills the values provided with the number of operator() calls that were answered from our
+        // likelihood cache, or needed a new calculation, since the cache was last resized.
+        void getLikelihoodCacheStatistics(long &nHits, long &nMisses) const;
+        // Records a profile of each subsequent fit() in the object provided, which is reset at the
+        // start of each fit. Use an empty pointer to stop profiling.
+        void setProfile(FitProfilePtr profile);
         // Fills the vector provided with the model prediction for the specified parameter values.
         void getPrediction(likely::Parameters const &params, std::vector<double> &prediction) const;
-        // Returns chiSquare/2 for the specified model parameter values.
+        // Returns chiSquare/2 for the specified model parameter values, using our likelihood
+        // cache if one is enabled.
         double operator()(likely::Parameters const &params) const;
         // Performs the fit and returns an estimate of the function minimum. Use the optional
         // config parameter to provide a script that will modify the initial parameter values
-        // and errors (including fixed/floating) for this fit only.
+        // and errors (including fixed/floating) for this fit only. The method "baofit::lm"
+        // uses our own Levenberg-Marquardt engine, which exploits the chi-square form of our
+        // likelihood. Its covariance is the inverse of the Gauss-Newton Hessian J.Cinv.J plus the
+        // numerical curvature of the priors at the minimum, which neglects the second derivatives
+        // of the prediction, so its errors can differ from those of the likely minimizers for
+        // strongly non-linear models. Any other method is passed to the likely minimizer.
         likely::FunctionMinimumPtr fit(std::string const &methodName, std::string const &config = "") const;
         // Guesses the function minimum using the model's initial fit parameter values and errors, and
         // assuming a diagonal covariance.
@@ -41,6 +78,67 @@ namespace baofit {
         AbsCorrelationDataCPtr _data;
         AbsCorrelationModelPtr _model;
         double _errorScale;
+        // Returns delta.Cinv.delta using our cached copy of the data's inverse covariance.
+        double _chiSquare(std::vector<double> const &delta) const;
+        // Fills result[0..nbins-1] with Cinv.v using our cached copy of the data's inverse covariance.
+        void _multiplyInverseCovariance(double const *v, double *result) const;
+        // Implements operator() without using our likelihood cache.
+        double _evaluate(likely::Parameters const &params) const;
+        // Performs a fit without any analytic treatment of linear parameters.
+        likely::FunctionMinimumPtr _fit(std::string const &methodName, std::string const &config) const;
+        // Performs a fit where the minimizer only sees the parameters that are not linear.
+        likely::FunctionMinimumPtr _fitAnalyticLinear(std::string const &methodName,
+            std::string const &config) const;
+        // Returns our likelihood after solving for the values of the linear parameters listed in
+        // _linearIndices, which are saved in _linearParams.
+        double _evaluateAnalyticLinear(likely::Parameters const &params) const;
+        // Minimizes our likelihood with a Levenberg-Marquardt iteration using the Gauss-Newton
+        // approximation J.Cinv.J to the chi-square Hessian, where J is the Jacobian of our prediction.
+        likely::FunctionMinimumPtr _fitLevenbergMarquardt(std::string const &config) const;
+        // The coordinates and value of each bin with data, in offset order, are copied from the
+        // data at construction so that no virtual lookups are needed during the fit.
+        std::vector<double> _r, _mu, _z, _dataValues;
+        std::vector<cosmo::Multipole> _multipole;
+        // Our copy of the inverse covariance is stored either densely, as its lower triangle in packed
+        // row-major order in _icov, or sparsely, as its diagonal in _icov and the nonzero elements
+        // below the diagonal in compressed rows: row i has _icovValues[k] in column _icovColumns[k]
+        // for k = _icovRowBegin[i],...,_icovRowBegin[i+1]-1. The choice depends on the fill fraction.
+        // When the data knows which elements might be nonzero, only those are copied.
+        bool _sparse;
+        std::vector<double> _icov, _icovValues;
+        std::vector<int> _icovColumns, _icovRowBegin;
+        // Work buffers that are re-used for every likelihood evaluation.
+        mutable std::vector<double> _prediction, _residual;
+        // Bins [_rangeBegin[k],_rangeBegin[k+1]) are evaluated using our context _contexts[k].
+        std::vector<int> _rangeBegin;
+        std::vector<EvaluationContextPtr> _contexts;
+        void _evaluateRange(int index, double *prediction) const;
+        // Binds each context to the coordinates that _evaluateRange() will use with it.
+        void _bindRanges();
+        // When integrating over bins, the prediction for bin i is the sum of _nodeWeight[j]*_nodePrediction[j]
+        // for j = _nodeBegin[i],...,_nodeBegin[i+1]-1, and the model is evaluated at each node instead
+        // of at each bin. The basis vectors for each node are stored like _basis in _nodeBasis.
+        std::vector<double> _nodeR, _nodeMu, _nodeZ, _nodeWeight;
+        std::vector<int> _nodeBegin;
+        mutable std::vector<double> _nodePrediction, _nodeBasis;
+        // State used to solve for linear parameters during fit(). The basis vector for each of
+        // the model's linear parameters is stored in _basis[k*nbins...(k+1)*nbins-1], and
+        // _linearIndices[k] is the parameter index corresponding to _linearColumns[k].
+        bool _analyticLinear;
+        mutable bool _solveLinear;
+        mutable std::vector<int> _linearIndices, _linearColumns;
+        mutable std::vector<double> _basis, _weightedBasis, _normal, _solution,
+            _priorCurvature, _priorCenter;
+        mutable likely::Parameters _linearParams;
+        void _setSolveLinear(bool value) const;
+        // Optional cache of recent likelihood values.
+        class LikelihoodCache;
+        boost::scoped_ptr<LikelihoodCache> _cache;
+        // Profile of the current fit, if any.
+        FitProfilePtr _profile;
+        // Persistent worker threads that evaluate ranges 1,2,... while the calling thread evaluates range 0.
+        class WorkerPool;
+        boost::scoped_ptr<WorkerPool> _workers;
 	}; // CorrelationFitter
 } // baofit
 
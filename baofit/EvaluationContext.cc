@@ -0,0 +1,13 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/EvaluationContext.h"
+
+#include "likely/Interpolator.h"
+
+namespace local = baofit;
+
+local::EvaluationContext::EvaluationContext()
+: _boundSize(-1), _boundR(0), _boundZ(0), _boundAngles(0)
+{ }
+
+local::EvaluationContext::~EvaluationContext() { }
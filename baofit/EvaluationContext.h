@@ -0,0 +1,70 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#ifndef BAOFIT_EVALUATION_CONTEXT
+#define BAOFIT_EVALUATION_CONTEXT
+
+#include "baofit/types.h"
+
+#include "likely/types.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace baofit {
+    // Holds the scratch buffers and cached objects that a correlation model needs during one
+    // evaluation, so that models can be evaluated concurrently from several threads with each
+    // thread using its own context. Storage is identified by the address of the model that owns
+    // it and a model-specific slot number, so that sub-models can share a context.
+	class EvaluationContext {
+	public:
+		EvaluationContext();
+		virtual ~EvaluationContext();
+        // Returns a reference to the buffer identified by owner and slot, which is empty when
+        // first used. Owners are free to resize the buffer, which will be retained by this context.
+        std::vector<double> &getBuffer(void const *owner, int slot);
+        // Returns a reference to the interpolator identified by owner and slot, which is initially
+        // an empty pointer. Interpolators are not safe to share between threads, so an owner that
+        // needs one should create it here on first use.
+        likely::InterpolatorPtr &getInterpolator(void const *owner, int slot);
+        // Sets the profile where models should record statistics about their use of this context,
+        // or null (the default) to disable profiling. Each thread should use a different profile.
+        void setProfile(FitProfilePtr profile);
+        // Returns a pointer to the profile set above, or null when we are not profiling.
+        FitProfile *getProfile() const;
+        // Records that models have precomputed per-bin quantities in this context for the n bins
+        // with the specified coordinate arrays, where angles points to either mu values or multipoles.
+        void setBinding(int n, double const *r, void const *angles, double const *z);
+        // Returns true if this context is bound to the specified coordinate arrays.
+        bool isBound(int n, double const *r, void const *angles, double const *z) const;
+	private:
+        typedef std::pair<void const*,int> Key;
+        std::map<Key,std::vector<double> > _buffers;
+        std::map<Key,likely::InterpolatorPtr> _interpolators;
+        FitProfilePtr _profile;
+        int _boundSize;
+        double const *_boundR, *_boundZ;
+        void const *_boundAngles;
+	}; // EvaluationContext
+	
+    inline std::vector<double> &EvaluationContext::getBuffer(void const *owner, int slot) {
+        return _buffers[Key(owner,slot)];
+    }
+    inline likely::InterpolatorPtr &EvaluationContext::getInterpolator(void const *owner, int slot) {
+        return _interpolators[Key(owner,slot)];
+    }
+    inline void EvaluationContext::setProfile(FitProfilePtr profile) { _profile = profile; }
+    inline FitProfile *EvaluationContext::getProfile() const { return _profile.get(); }
+    inline void EvaluationContext::setBinding(int n, double const *r, void const *angles, double const *z) {
+        _boundSize = n;
+        _boundR = r;
+        _boundAngles = angles;
+        _boundZ = z;
+    }
+    inline bool EvaluationContext::isBound(int n, double const *r, void const *angles, double const *z) const {
+        return n == _boundSize && r == _boundR && angles == _boundAngles && z == _boundZ;
+    }
+
+} // baofit
+
+#endif // BAOFIT_EVALUATION_CONTEXT
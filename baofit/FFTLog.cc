@@ -0,0 +1,91 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/FFTLog.h"
+#include "baofit/RuntimeError.h"
+
+#include "gsl/gsl_sf_gamma.h"
+
+#include <cmath>
+
+namespace local = baofit;
+
+local::FFTLog::FFTLog(int n, double kmin, double kmax, int ell, double q)
+: _n(n), _ell(ell), _kmin(kmin), _rmin(1/kmax), _q(q), _wavetable(0), _workspace(0)
+{
+    if(n < 2) throw RuntimeError("FFTLog: expected n >= 2.");
+    if(kmin <= 0 || kmax <= kmin) throw RuntimeError("FFTLog: expected 0 < kmin < kmax.");
+    if(ell < 0) throw RuntimeError("FFTLog: expected ell >= 0.");
+    if(q <= -ell || q >= 2) throw RuntimeError("FFTLog: expected -ell < q < 2.");
+    _delta = std::log(kmax/kmin)/(n-1);
+    double pi(4*std::atan(1));
+    // Tabulate the power-law bias applied to the input and removed from the output.
+    _inputScale.resize(n);
+    _outputScale.resize(n);
+    for(int j = 0; j < n; ++j) {
+        _inputScale[j] = std::pow(getK(j),3-q)/(2*pi*pi);
+        _outputScale[j] = std::pow(getR(j),-q);
+    }
+    // Tabulate the Mellin transform of j_ell(t) for each Fourier mode m with s = q + i*eta,
+    //
+    //   U(s) = 2^(s-2) sqrt(pi) Gamma((ell+s)/2) / Gamma((3+ell-s)/2)
+    //
+    // combined with the phase (kmin*rmin)^(-i*eta) that relates the input and output grids.
+    // The Nyquist mode of an even-sized grid has no conjugate partner, so is dropped.
+    _kernel.assign(2*n,0);
+    double logkr(std::log(_kmin*_rmin)), log2(std::log(2.));
+    for(int m = 0; m < n; ++m) {
+        int mm = (2*m < n) ? m : m - n;
+        if(2*mm == -n) continue;
+        double eta = 2*pi*mm/(n*_delta);
+        gsl_sf_result lnNum, argNum, lnDen, argDen;
+        gsl_sf_lngamma_complex_e((ell+q)/2,eta/2,&lnNum,&argNum);
+        gsl_sf_lngamma_complex_e((3+ell-q)/2,-eta/2,&lnDen,&argDen);
+        double logMagnitude = (q-2)*log2 + 0.5*std::log(pi) + lnNum.val - lnDen.val;
+        double phase = eta*log2 + argNum.val - argDen.val - eta*logkr;
+        double magnitude = std::exp(logMagnitude)/n;
+        _kernel[2*m] = magnitude*std::cos(phase);
+        _kernel[2*m+1] = magnitude*std::sin(phase);
+    }
+    _data.resize(2*n);
+    _wavetable = gsl_fft_complex_wavetable_alloc(n);
+    _workspace = gsl_fft_complex_workspace_alloc(n);
+    if(0 == _wavetable || 0 == _workspace) {
+        if(_wavetable) gsl_fft_complex_wavetable_free(_wavetable);
+        if(_workspace) gsl_fft_complex_workspace_free(_workspace);
+        throw RuntimeError("FFTLog: unable to allocate FFT resources.");
+    }
+}
+
+local::FFTLog::~FFTLog() {
+    gsl_fft_complex_wavetable_free(_wavetable);
+    gsl_fft_complex_workspace_free(_workspace);
+}
+
+double local::FFTLog::getK(int j) const {
+    return _kmin*std::exp(j*_delta);
+}
+
+double local::FFTLog::getR(int j) const {
+    return _rmin*std::exp(j*_delta);
+}
+
+void local::FFTLog::transform(double const *f, double *xi) {
+    // Expand the biased input k^3 f(k) k^(-q)/(2pi^2) as a Fourier series in log(k).
+    double *data = &_data[0];
+    for(int j = 0; j < _n; ++j) {
+        data[2*j] = _inputScale[j]*f[j];
+        data[2*j+1] = 0;
+    }
+    gsl_fft_complex_forward(data,1,_n,_wavetable,_workspace);
+    // Transform each Fourier mode analytically.
+    double const *kernel = &_kernel[0];
+    for(int m = 0; m < _n; ++m) {
+        double re(data[2*m]), im(data[2*m+1]);
+        data[2*m] = re*kernel[2*m] - im*kernel[2*m+1];
+        data[2*m+1] = re*kernel[2*m+1] + im*kernel[2*m];
+    }
+    // Sum the transformed modes on the output grid, where r^(-i*eta) provides the same phases
+    // as a second forward FFT. The imaginary parts cancel between conjugate modes.
+    gsl_fft_complex_forward(data,1,_n,_wavetable,_workspace);
+    for(int j = 0; j < _n; ++j) xi[j] = _outputScale[j]*data[2*j];
+}
@@ -0,0 +1,57 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#ifndef BAOFIT_FFTLOG
+#define BAOFIT_FFTLOG
+
+#include "gsl/gsl_fft_complex.h"
+
+#include <vector>
+
+namespace baofit {
+    // Calculates the spherical Bessel transform
+    //
+    //   xi(r) = Integral[k^2 dk/(2pi^2) f(k) j_ell(kr), {k,0,Infinity}]
+    //
+    // of a function f(k) sampled on a logarithmic grid using the FFTLog algorithm of
+    // Hamilton (2000), with the results obtained on a logarithmic grid in r. The transform
+    // kernel, FFT wavetable and workspace are calculated once when the plan is created so
+    // that repeated transforms only require two FFTs of the grid size.
+	class FFTLog {
+	public:
+	    // Creates a new plan for transforming the multipole ell of functions sampled at n points
+	    // k[j] = kmin*exp(j*delta) for j = 0,1,...,n-1 with delta = log(kmax/kmin)/(n-1). Results
+	    // are obtained at r[j] = rmin*exp(j*delta) with rmin = 1/kmax, so that the r grid covers
+	    // [1/kmax,1/kmin]. The transform uses a power-law bias f(k) ~ k^(q-3) when sampling the
+	    // input, which must satisfy -ell < q < 2.
+		FFTLog(int n, double kmin, double kmax, int ell, double q = 1);
+		virtual ~FFTLog();
+        // Returns the number of grid points used by this plan.
+        int getSize() const;
+        // Returns the k or r value of the j-th grid point.
+        double getK(int j) const;
+        double getR(int j) const;
+        // Fills xi[0..n-1] with the transform evaluated at each r[j] of the input function sampled
+        // as f[j] = f(k[j]). The same array can be used for input and output.
+        void transform(double const *f, double *xi);
+	private:
+        // Plans are not copyable since they own GSL resources.
+        FFTLog(FFTLog const &other);
+        FFTLog &operator=(FFTLog const &other);
+        int _n, _ell;
+        double _kmin, _rmin, _delta, _q;
+        // Complex transform kernel for each Fourier mode, including the 1/n normalization of
+        // the first FFT, stored as (re,im) pairs.
+        std::vector<double> _kernel;
+        // Factors k[j]^(3-q)/(2pi^2) applied to the input and r[j]^(-q) applied to the output.
+        std::vector<double> _inputScale, _outputScale;
+        // Scratch space for (re,im) pairs.
+        std::vector<double> _data;
+        gsl_fft_complex_wavetable *_wavetable;
+        gsl_fft_complex_workspace *_workspace;
+	}; // FFTLog
+
+    inline int FFTLog::getSize() const { return _n; }
+
+} // baofit
+
+#endif // BAOFIT_FFTLOG
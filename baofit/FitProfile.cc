@@ -0,0 +1,117 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/FitProfile.h"
+
+#include "boost/format.hpp"
+
+#include <iostream>
+#include <sys/time.h>
+
+namespace local = baofit;
+
+namespace baofit {
+    char const *categoryNames[FitProfile::NCategories] = {
+        "prediction", "chi-square", "priors", "linear-solve"
+    };
+}
+
+local::FitProfile::FitProfile() {
+    reset();
+}
+
+local::FitProfile::~FitProfile() { }
+
+local::FitProfile::TermCounters::TermCounters()
+: elapsed(0), nCalculated(0), nCached(0)
+{ }
+
+double local::FitProfile::getWallTime() {
+    struct timeval now;
+    gettimeofday(&now,0);
+    return now.tv_sec + 1e-6*now.tv_usec;
+}
+
+void local::FitProfile::reset() {
+    _fitTime = 0;
+    _nFits = _nEvaluations = 0;
+    for(int category = 0; category < NCategories; ++category) {
+        _elapsed[category] = 0;
+        _nCalls[category] = 0;
+    }
+    _terms.clear();
+}
+
+void local::FitProfile::addFitTime(double elapsed) {
+    _fitTime += elapsed;
+    ++_nFits;
+}
+
+void local::FitProfile::addTerm(char const *name, bool cached, double elapsed) {
+    TermCounters &counters = _terms[name];
+    if(cached) {
+        ++counters.nCached;
+    }
+    else {
+        ++counters.nCalculated;
+        counters.elapsed += elapsed;
+    }
+}
+
+void local::FitProfile::add(FitProfile const &other) {
+    _fitTime += other._fitTime;
+    _nFits += other._nFits;
+    _nEvaluations += other._nEvaluations;
+    for(int category = 0; category < NCategories; ++category) {
+        _elapsed[category] += other._elapsed[category];
+        _nCalls[category] += other._nCalls[category];
+    }
+    for(std::map<std::string,TermCounters>::const_iterator iter = other._terms.begin();
+    iter != other._terms.end(); ++iter) {
+        TermCounters &counters = _terms[iter->first];
+        counters.elapsed += iter->second.elapsed;
+        counters.nCalculated += iter->second.nCalculated;
+        counters.nCached += iter->second.nCached;
+    }
+}
+
+void local::FitProfile::printToStream(std::ostream &out, std::string const &label) const {
+    boost::format header("Profile of %s: %d evaluations in %.3f s (%.1f evaluations/s)\n"),
+        category("  %-16s %10.4f s %6.1f%% %10d calls\n"),
+        term("  %-16s %10.4f s %10d calculated %10d cached (%.1f%% hit rate)\n");
+    double rate = _fitTime > 0 ? _nEvaluations/_fitTime : 0;
+    out << header % label % _nEvaluations % _fitTime % rate;
+    // Any time not spent in one of our categories is attributed to the minimizer.
+    double overhead(_fitTime);
+    for(int index = 0; index < NCategories; ++index) {
+        if(0 == _nCalls[index]) continue;
+        double percent = _fitTime > 0 ? 100*_elapsed[index]/_fitTime : 0;
+        out << category % categoryNames[index] % _elapsed[index] % percent % _nCalls[index];
+        overhead -= _elapsed[index];
+    }
+    out << category % "minimizer" % overhead % (_fitTime > 0 ? 100*overhead/_fitTime : 0) % _nFits;
+    if(_terms.empty()) return;
+    out << "  Cached terms (times are summed over threads):" << std::endl;
+    for(std::map<std::string,TermCounters>::const_iterator iter = _terms.begin();
+    iter != _terms.end(); ++iter) {
+        TermCounters const &counters = iter->second;
+        long total = counters.nCalculated + counters.nCached;
+        out << term % iter->first % counters.elapsed % counters.nCalculated % counters.nCached
+            % (total > 0 ? (100.*counters.nCached)/total : 0);
+    }
+}
+
+void local::FitProfile::saveToStream(std::ostream &out, std::string const &label) const {
+    boost::format line("%s %s %.6f %d %d\n");
+    out << line % label % "fit" % _fitTime % _nEvaluations % 0;
+    double overhead(_fitTime);
+    for(int index = 0; index < NCategories; ++index) {
+        out << line % label % categoryNames[index] % _elapsed[index] % _nCalls[index] % 0;
+        overhead -= _elapsed[index];
+    }
+    out << line % label % "minimizer" % overhead % _nFits % 0;
+    for(std::map<std::string,TermCounters>::const_iterator iter = _terms.begin();
+    iter != _terms.end(); ++iter) {
+        out << line % label % ("term:" + iter->first) % iter->second.elapsed
+            % iter->second.nCalculated % iter->second.nCached;
+    }
+}
@@ -0,0 +1,80 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#ifndef BAOFIT_FIT_PROFILE
+#define BAOFIT_FIT_PROFILE
+
+#include <map>
+#include <string>
+#include <iosfwd>
+
+namespace baofit {
+    // Accumulates a breakdown of the wall time spent during one fit, together with counts of
+    // likelihood evaluations and of model terms that were either recalculated or cached.
+	class FitProfile {
+	public:
+        // Identifies the components of each likelihood evaluation that we time separately.
+        enum Category { Prediction, ChiSquare, Priors, LinearSolve, NCategories };
+		FitProfile();
+		virtual ~FitProfile();
+        // Returns the current wall time in seconds relative to an arbitrary fixed origin.
+        static double getWallTime();
+        // Resets all of our counters to zero.
+        void reset();
+        // Returns the total wall time of all recorded fits.
+        double getFitTime() const;
+        // Returns the number of recorded likelihood evaluations.
+        long getNEvaluations() const;
+        // Records the wall time of a complete fit.
+        void addFitTime(double elapsed);
+        // Records one likelihood evaluation.
+        void addEvaluation();
+        // Records one call of the specified category that took the specified wall time.
+        void addTime(Category category, double elapsed);
+        // Records that the named model term was either recalculated, taking the specified wall
+        // time, or reused from a cache.
+        void addTerm(char const *name, bool cached, double elapsed = 0);
+        // Adds the counters of another profile to ours.
+        void add(FitProfile const &other);
+        // Prints a multi-line human-readable summary of this profile to the specified output stream.
+        void printToStream(std::ostream &out, std::string const &label) const;
+        // Saves this profile to the specified output stream as lines of whitespace-separated
+        // "label item seconds count cached" values.
+        void saveToStream(std::ostream &out, std::string const &label) const;
+        // Records the wall time between its construction and destruction in the profile provided,
+        // unless it is null.
+        class Timer {
+        public:
+            Timer(FitProfile *profile, Category category);
+            ~Timer();
+        private:
+            FitProfile *_profile;
+            Category _category;
+            double _start;
+        };
+	private:
+        struct TermCounters {
+            TermCounters();
+            double elapsed;
+            long nCalculated, nCached;
+        };
+        double _fitTime, _elapsed[NCategories];
+        long _nFits, _nEvaluations, _nCalls[NCategories];
+        std::map<std::string,TermCounters> _terms;
+	}; // FitProfile
+
+    inline double FitProfile::getFitTime() const { return _fitTime; }
+    inline long FitProfile::getNEvaluations() const { return _nEvaluations; }
+    inline void FitProfile::addEvaluation() { ++_nEvaluations; }
+    inline void FitProfile::addTime(Category category, double elapsed) {
+        _elapsed[category] += elapsed;
+        ++_nCalls[category];
+    }
+    inline FitProfile::Timer::Timer(FitProfile *profile, Category category)
+    : _profile(profile), _category(category), _start(profile ? getWallTime() : 0) { }
+    inline FitProfile::Timer::~Timer() {
+        if(_profile) _profile->addTime(_category,getWallTime() - _start);
+    }
+
+} // baofit
+
+#endif // BAOFIT_FIT_PROFILE
@@ -0,0 +1,218 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/ModelPack.h"
+#include "baofit/UniformSpline.h"
+#include "baofit/RuntimeError.h"
+
+#include "boost/cstdint.hpp"
+#include "boost/format.hpp"
+
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace local = baofit;
+
+namespace baofit {
+namespace pack {
+    // The binary format consists of a FileHeader, followed by nEntries EntryHeaders, followed by
+    // the coefficients of each entry starting at an offset that is a multiple of the alignment.
+    char const magic[8] = { 'B','A','O','F','I','T','M','P' };
+    // Written as a double so that readers can detect a different floating-point byte order.
+    double const byteOrderCheck = 1.0 + 1./1024;
+    int const alignment = 64;
+    int const maxNameLength = 128;
+    struct FileHeader {
+        char magic[8];
+        boost::uint32_t version, nEntries;
+        double byteOrderCheck, accuracy;
+        char fiducialName[maxNameLength], nowigglesName[maxNameLength];
+    };
+    struct EntryHeader {
+        char name[32];
+        double xmin, xmax, maxError;
+        boost::int32_t nIntervals, nFunctions, logSpacing, reserved;
+        boost::uint64_t offset;
+    };
+    char const *entryNames[3] = { "templates", "nowiggles", "nowiggles-power" };
+    // Unmaps a memory-mapped file when the last spline using it is deleted.
+    class Unmapper {
+    public:
+        Unmapper(std::size_t size) : _size(size) { }
+        void operator()(void const *address) const { ::munmap(const_cast<void*>(address),_size); }
+    private:
+        std::size_t _size;
+    };
+    void copyName(char *dest, std::string const &src) {
+        if(src.size() >= maxNameLength) throw RuntimeError("ModelPack: model name is too long.");
+        std::strcpy(dest,src.c_str());
+    }
+    std::string readName(char const *src, int maxLength) {
+        return std::string(src,std::find(src,src+maxLength,'\0'));
+    }
+}} // baofit::pack
+
+int const local::ModelPack::version;
+
+local::ModelPack::ModelPack(std::string const &filename)
+: _filename(filename)
+{
+    // Map the whole file into memory, read only.
+    int fd = ::open(filename.c_str(),O_RDONLY);
+    if(fd < 0) throw RuntimeError("ModelPack: unable to open " + filename);
+    struct stat info;
+    if(0 != ::fstat(fd,&info)) {
+        ::close(fd);
+        throw RuntimeError("ModelPack: unable to read " + filename);
+    }
+    std::size_t size(info.st_size);
+    void *address = size > 0 ? ::mmap(0,size,PROT_READ,MAP_SHARED,fd,0) : MAP_FAILED;
+    ::close(fd);
+    if(MAP_FAILED == address) throw RuntimeError("ModelPack: unable to map " + filename);
+    boost::shared_ptr<void const> mapping(address,pack::Unmapper(size));
+    char const *base = static_cast<char const*>(address);
+    // Check the file header.
+    if(size < sizeof(pack::FileHeader)) throw RuntimeError("ModelPack: file is too short.");
+    pack::FileHeader const &header = *reinterpret_cast<pack::FileHeader const*>(base);
+    if(0 != std::memcmp(header.magic,pack::magic,sizeof(pack::magic))) {
+        throw RuntimeError("ModelPack: " + filename + " is not a model pack.");
+    }
+    if(header.version != version) {
+        throw RuntimeError(boost::str(boost::format("ModelPack: %s has version %d but expected %d.")
+            % filename % header.version % version));
+    }
+    if(header.byteOrderCheck != pack::byteOrderCheck) {
+        throw RuntimeError("ModelPack: " + filename + " was created with a different byte order.");
+    }
+    if(size < sizeof(pack::FileHeader) + header.nEntries*sizeof(pack::EntryHeader)) {
+        throw RuntimeError("ModelPack: file is too short.");
+    }
+    _fiducialName = pack::readName(header.fiducialName,pack::maxNameLength);
+    _nowigglesName = pack::readName(header.nowigglesName,pack::maxNameLength);
+    _accuracy = header.accuracy;
+    // Create a spline view of each entry.
+    pack::EntryHeader const *entries =
+        reinterpret_cast<pack::EntryHeader const*>(base + sizeof(pack::FileHeader));
+    for(int index = 0; index < header.nEntries; ++index) {
+        pack::EntryHeader const &entry = entries[index];
+        std::size_t nbytes = sizeof(double)*4*(std::size_t)entry.nIntervals*entry.nFunctions;
+        if(entry.offset % sizeof(double) != 0 || entry.offset + nbytes > size) {
+            throw RuntimeError("ModelPack: corrupted entry in " + filename);
+        }
+        UniformSplinePtr spline(new UniformSpline(entry.xmin,entry.xmax,entry.nIntervals,
+            entry.nFunctions,entry.logSpacing,entry.maxError,
+            reinterpret_cast<double const*>(base + entry.offset),mapping));
+        std::string name = pack::readName(entry.name,sizeof(entry.name));
+        if(name == pack::entryNames[0]) _templates = spline;
+        else if(name == pack::entryNames[1]) _nwMultipoles = spline;
+        else if(name == pack::entryNames[2]) _nwPower = spline;
+    }
+    if(!_templates || !_nwMultipoles) {
+        throw RuntimeError("ModelPack: missing correlation function tables in " + filename);
+    }
+}
+
+local::ModelPack::~ModelPack() { }
+
+void local::ModelPack::create(std::string const &filename, std::string const &modelrootName,
+std::string const &fiducialName, std::string const &nowigglesName, double accuracy) {
+    // Build the interpolation tables.
+    std::vector<UniformSplinePtr> splines;
+    splines.push_back(readTemplates(modelrootName,fiducialName,nowigglesName,accuracy));
+    splines.push_back(readMultipoles(modelrootName,nowigglesName,accuracy));
+    std::string root(modelrootName);
+    if(0 < root.size() && root[root.size()-1] != '/') root += '/';
+    if(std::ifstream((root + nowigglesName + "_matterpower.dat").c_str()).good()) {
+        splines.push_back(readPower(modelrootName,nowigglesName,accuracy));
+    }
+    // Prepare the file and entry headers.
+    pack::FileHeader header;
+    std::memset(&header,0,sizeof(header));
+    std::memcpy(header.magic,pack::magic,sizeof(pack::magic));
+    header.version = version;
+    header.nEntries = splines.size();
+    header.byteOrderCheck = pack::byteOrderCheck;
+    header.accuracy = accuracy;
+    pack::copyName(header.fiducialName,fiducialName);
+    pack::copyName(header.nowigglesName,nowigglesName);
+    std::vector<pack::EntryHeader> entries(splines.size());
+    std::size_t offset = sizeof(header) + entries.size()*sizeof(pack::EntryHeader);
+    for(int index = 0; index < splines.size(); ++index) {
+        UniformSpline const &spline = *splines[index];
+        pack::EntryHeader &entry = entries[index];
+        std::memset(&entry,0,sizeof(entry));
+        std::strcpy(entry.name,pack::entryNames[index]);
+        entry.xmin = spline._xmin;
+        entry.xmax = spline._xmax;
+        entry.maxError = spline._maxError;
+        entry.nIntervals = spline._nIntervals;
+        entry.nFunctions = spline._nFunctions;
+        entry.logSpacing = spline._logSpacing;
+        offset = pack::alignment*((offset + pack::alignment - 1)/pack::alignment);
+        entry.offset = offset;
+        offset += sizeof(double)*4*spline._nIntervals*spline._nFunctions;
+    }
+    // Write the file.
+    std::ofstream out(filename.c_str(),std::ios::binary);
+    if(!out.good()) throw RuntimeError("ModelPack: unable to create " + filename);
+    out.write(reinterpret_cast<char const*>(&header),sizeof(header));
+    out.write(reinterpret_cast<char const*>(&entries[0]),entries.size()*sizeof(pack::EntryHeader));
+    for(int index = 0; index < splines.size(); ++index) {
+        UniformSpline const &spline = *splines[index];
+        std::size_t padding = entries[index].offset - out.tellp();
+        out.write(std::string(padding,'\0').c_str(),padding);
+        out.write(reinterpret_cast<char const*>(spline._coefs),
+            sizeof(double)*4*spline._nIntervals*spline._nFunctions);
+    }
+    out.close();
+    if(!out) throw RuntimeError("ModelPack: error while writing " + filename);
+}
+
+local::UniformSplinePtr local::ModelPack::readTemplates(std::string const &modelrootName,
+std::string const &fiducialName, std::string const &nowigglesName, double accuracy) {
+    std::string root(modelrootName);
+    if(0 < root.size() && root[root.size()-1] != '/') root += '/';
+    boost::format fileName("%s%s.%d.dat");
+    std::vector<std::vector<double> > x(6), y(6);
+    for(int index = 0; index < 6; ++index) {
+        std::string const &name = index < 3 ? fiducialName : nowigglesName;
+        UniformSpline::readTable(boost::str(fileName % root % name % (2*(index % 3))),x[index],y[index]);
+    }
+    return UniformSplinePtr(new UniformSpline(x,y,accuracy));
+}
+
+local::UniformSplinePtr local::ModelPack::readMultipoles(std::string const &modelrootName,
+std::string const &name, double accuracy) {
+    std::string root(modelrootName);
+    if(0 < root.size() && root[root.size()-1] != '/') root += '/';
+    boost::format fileName("%s%s.%d.dat");
+    std::vector<std::vector<double> > x(3), y(3);
+    for(int index = 0; index < 3; ++index) {
+        UniformSpline::readTable(boost::str(fileName % root % name % (2*index)),x[index],y[index]);
+    }
+    return UniformSplinePtr(new UniformSpline(x,y,accuracy));
+}
+
+local::UniformSplinePtr local::ModelPack::readPower(std::string const &modelrootName,
+std::string const &name, double accuracy) {
+    std::string root(modelrootName);
+    if(0 < root.size() && root[root.size()-1] != '/') root += '/';
+    std::vector<double> k, Pk;
+    UniformSpline::readTable(root + name + "_matterpower.dat",k,Pk);
+    return UniformSplinePtr(new UniformSpline(k,Pk,accuracy,true));
+}
+
+local::UniformSplinePtr local::ModelPack::getTemplates() const { return _templates; }
+
+local::UniformSplinePtr local::ModelPack::getNoWigglesMultipoles() const { return _nwMultipoles; }
+
+local::UniformSplinePtr local::ModelPack::getNoWigglesPower() const {
+    if(!_nwPower) throw RuntimeError("ModelPack: no power spectrum in " + _filename);
+    return _nwPower;
+}
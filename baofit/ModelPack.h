@@ -0,0 +1,63 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#ifndef BAOFIT_MODEL_PACK
+#define BAOFIT_MODEL_PACK
+
+#include "baofit/types.h"
+
+#include <string>
+
+namespace baofit {
+    // Represents the interpolation tables of one model family (fiducial and no-wiggles correlation
+    // function multipoles, and the no-wiggles power spectrum) stored in a versioned binary file as
+    // ready-to-use spline coefficients. The file is memory mapped read only, so opening it involves
+    // no parsing and its pages are shared by all processes on the same node that use it.
+	class ModelPack {
+	public:
+        // Opens and memory maps the named pack file, which must have been created with create().
+		ModelPack(std::string const &filename);
+		virtual ~ModelPack();
+        // Builds the interpolation tables for the named model family from the text files
+        // <name>.<ell>.dat (ell=0,2,4) and, if present, <nowiggles>_matterpower.dat in modelroot,
+        // with the specified relative accuracy, and saves them to a new pack file.
+        static void create(std::string const &filename, std::string const &modelrootName,
+            std::string const &fiducialName, std::string const &nowigglesName, double accuracy);
+        // Reads the tabulated multipoles of the fiducial (ell=0,2,4) then no-wiggles (ell=0,2,4)
+        // models and interpolates them on a shared grid.
+        static UniformSplinePtr readTemplates(std::string const &modelrootName,
+            std::string const &fiducialName, std::string const &nowigglesName, double accuracy);
+        // Reads the tabulated multipoles (ell=0,2,4) of a single model and interpolates them on a
+        // shared grid.
+        static UniformSplinePtr readMultipoles(std::string const &modelrootName,
+            std::string const &name, double accuracy);
+        // Reads the tabulated power spectrum of a single model and interpolates it on a grid that
+        // is uniform in log(k).
+        static UniformSplinePtr readPower(std::string const &modelrootName,
+            std::string const &name, double accuracy);
+        // Returns the names of the model family and the accuracy used to create this pack.
+        std::string const &getFiducialName() const;
+        std::string const &getNoWigglesName() const;
+        double getAccuracy() const;
+        // Returns the interpolation tables stored in this pack, in the formats described above.
+        // These remain valid after this object is deleted.
+        UniformSplinePtr getTemplates() const;
+        UniformSplinePtr getNoWigglesMultipoles() const;
+        UniformSplinePtr getNoWigglesPower() const;
+        // Returns true if this pack includes a no-wiggles power spectrum.
+        bool hasPower() const;
+        // The current version of the binary format that we read and write.
+        static int const version = 1;
+	private:
+        std::string _filename, _fiducialName, _nowigglesName;
+        double _accuracy;
+        UniformSplinePtr _templates, _nwMultipoles, _nwPower;
+	}; // ModelPack
+
+    inline std::string const &ModelPack::getFiducialName() const { return _fiducialName; }
+    inline std::string const &ModelPack::getNoWigglesName() const { return _nowigglesName; }
+    inline double ModelPack::getAccuracy() const { return _accuracy; }
+    inline bool ModelPack::hasPower() const { return bool(_nwPower); }
+
+} // baofit
+
+#endif // BAOFIT_MODEL_PACK
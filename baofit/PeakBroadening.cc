@@ -0,0 +1,117 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/PeakBroadening.h"
+#include "baofit/FFTLog.h"
+#include "baofit/UniformSpline.h"
+#include "baofit/RuntimeError.h"
+#include "baofit/quadrature.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace local = baofit;
+
+namespace baofit {
+namespace broadening {
+    // Number of Gauss-Legendre nodes on [0,1] used to calculate the multipoles of the damping.
+    // The undamped moments are exact and the damped moments are accurate to better than 1e-6
+    // for k*|Sigma_par^2 - Sigma_perp^2|^(1/2) up to about 17.
+    int const nMuNodes = 32;
+    // Maximum number of distinct damping scales whose templates we cache.
+    int const maxCached = 64;
+}} // baofit::broadening
+
+local::PeakBroadening::PeakBroadening(std::string const &modelrootName, std::string const &fiducialName,
+std::string const &nowigglesName, double rmin, double rmax, double accuracy, int nk)
+: _nCalculated(0), _nCached(0)
+{
+    if(rmin <= 0 || rmax <= rmin) throw RuntimeError("PeakBroadening: expected 0 < rmin < rmax.");
+    // Read the fiducial and no-wiggles power spectra and interpolate them on a shared grid.
+    std::string root(modelrootName);
+    if(0 < root.size() && root[root.size()-1] != '/') root += '/';
+    std::vector<std::vector<double> > k(2), Pk(2);
+    UniformSpline::readTable(root + fiducialName + "_matterpower.dat",k[0],Pk[0]);
+    UniformSpline::readTable(root + nowigglesName + "_matterpower.dat",k[1],Pk[1]);
+    UniformSpline power(k,Pk,accuracy,true);
+    // Create the transform plans for each multipole on a grid covering the common k range.
+    double kmin(power.getXMin()), kmax(power.getXMax());
+    for(int ell = 0; ell <= 4; ell += 2) _plans.push_back(FFTLogPtr(new FFTLog(nk,kmin,kmax,ell)));
+    FFTLog const &plan = *_plans[0];
+    // Tabulate the peak power on the transform grid, protecting against round-off at the edges.
+    _peakPower.resize(nk);
+    double P[2];
+    for(int j = 0; j < nk; ++j) {
+        power.evaluate(std::min(std::max(plan.getK(j),kmin),kmax),P);
+        _peakPower[j] = P[0] - P[1];
+    }
+    // Find the range of transform grid points that covers [rmin,rmax].
+    if(rmin < plan.getR(0) || rmax > plan.getR(nk-1)) {
+        throw RuntimeError("PeakBroadening: power spectrum k range is too small for [rmin,rmax].");
+    }
+    for(_rFirst = 0; plan.getR(_rFirst+1) <= rmin; ++_rFirst) ;
+    for(_rLast = nk-1; plan.getR(_rLast-1) >= rmax; --_rLast) ;
+    // Tabulate the multipole projections of mu^n, using the symmetry in mu.
+    std::vector<double> weights;
+    getGaussLegendreRule(broadening::nMuNodes,0,1,_muNodes,weights);
+    int nMu(broadening::nMuNodes);
+    _moments.resize(9*nMu);
+    for(int j = 0; j < nMu; ++j) {
+        double muSq(_muNodes[j]*_muNodes[j]);
+        double L[3] = { 1, (3*muSq - 1)/2., (35*muSq*muSq - 30*muSq + 3)/8. };
+        double muPower[3] = { 1, muSq, muSq*muSq };
+        for(int ell = 0; ell <= 4; ell += 2) {
+            for(int n = 0; n <= 4; n += 2) {
+                _moments[(3*(ell/2) + n/2)*nMu + j] = (2*ell+1)*weights[j]*muPower[n/2]*L[ell/2];
+            }
+        }
+    }
+}
+
+local::PeakBroadening::~PeakBroadening() { }
+
+local::UniformSplinePtr local::PeakBroadening::getTemplates(double sigmaPar, double sigmaPerp) {
+    std::pair<double,double> key(sigmaPar,sigmaPerp);
+    TemplateCache::iterator found = _cache.find(key);
+    if(found != _cache.end()) {
+        ++_nCached;
+        return found->second;
+    }
+    // Calculate the multipoles of mu^n times the damped peak power at each k.
+    int nk(_peakPower.size()), nMu(_muNodes.size());
+    double parSq(sigmaPar*sigmaPar), perpSq(sigmaPerp*sigmaPerp);
+    std::vector<double> damping(nMu), xi(9*nk);
+    for(int j = 0; j < nk; ++j) {
+        double k(_plans[0]->getK(j)), halfkSq(0.5*k*k);
+        for(int node = 0; node < nMu; ++node) {
+            double muSq(_muNodes[node]*_muNodes[node]);
+            damping[node] = std::exp(-halfkSq*(perpSq + (parSq - perpSq)*muSq));
+        }
+        for(int t = 0; t < 9; ++t) {
+            double const *moments = &_moments[t*nMu];
+            double sum(0);
+            for(int node = 0; node < nMu; ++node) sum += moments[node]*damping[node];
+            xi[t*nk + j] = _peakPower[j]*sum;
+        }
+    }
+    // Transform each multipole in place, including the i^ell factor.
+    for(int t = 0; t < 9; ++t) {
+        int ell(2*(t/3));
+        _plans[t/3]->transform(&xi[t*nk],&xi[t*nk]);
+        if(ell == 2) {
+            for(int j = 0; j < nk; ++j) xi[t*nk + j] = -xi[t*nk + j];
+        }
+    }
+    // Interpolate the templates over our range of r directly on the transform grid, which is
+    // already uniform in log(r), so no resampling is needed.
+    int nr(_rLast - _rFirst + 1);
+    std::vector<std::vector<double> > y(9,std::vector<double>(nr));
+    for(int t = 0; t < 9; ++t) {
+        for(int i = 0; i < nr; ++i) y[t][i] = xi[t*nk + _rFirst + i];
+    }
+    UniformSplinePtr templates(new UniformSpline(_plans[0]->getR(_rFirst),_plans[0]->getR(_rLast),y,true));
+    // Start over when the cache is full, which should only happen when the damping is floating.
+    if(_cache.size() >= broadening::maxCached) _cache.clear();
+    _cache.insert(std::make_pair(key,templates));
+    ++_nCalculated;
+    return templates;
+}
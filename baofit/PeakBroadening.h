@@ -0,0 +1,66 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#ifndef BAOFIT_PEAK_BROADENING
+#define BAOFIT_PEAK_BROADENING
+
+#include "baofit/types.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+namespace baofit {
+    // Calculates the multipoles of the BAO peak correlation function with an anisotropic Gaussian
+    // damping of the peak power Pfid(k) - Pnw(k),
+    //
+    //   exp(-k^2 (mu^2 Sigma_par^2 + (1-mu^2) Sigma_perp^2)/2)
+    //
+    // which models the non-linear broadening of the peak. The redshift-space distortion factor
+    // (1 + beta mu^2)^2 = 1 + 2 beta mu^2 + beta^2 mu^4 is handled by tabulating the separate
+    // beta-independent templates T(n,ell,r) obtained by transforming the ell-th multipole of
+    // mu^n times the damped peak power with FFTLog, so that the redshift-space peak is
+    //
+    //   xi(r,mu) = b^2 Sum[L_ell(mu) (T(0,ell,r) + 2 beta T(2,ell,r) + beta^2 T(4,ell,r)), {ell,0,2,4}]
+    //
+    // Templates are cached for the most recently used damping scales, so that fits where the
+    // damping is fixed or only changes occasionally do not repeat any transforms.
+	class PeakBroadening {
+	public:
+	    // Creates a new peak broadening model using the fiducial and no-wiggles power spectra
+	    // read from <name>_matterpower.dat. The power spectra are resampled onto nk points uniformly
+	    // spaced in log(k) for the transforms, with the specified relative interpolation accuracy.
+	    // Templates are splines through the transformed values on the corresponding log(r) grid,
+	    // covering [rmin,rmax] in Mpc/h.
+		PeakBroadening(std::string const &modelrootName, std::string const &fiducialName,
+            std::string const &nowigglesName, double rmin, double rmax, double accuracy = 1e-6,
+            int nk = 2048);
+		virtual ~PeakBroadening();
+        // Returns the templates for the specified damping scales in Mpc/h, calculating them if
+        // necessary. Template T(n,ell,r) is stored as function 3*(ell/2) + n/2 of the result.
+        UniformSplinePtr getTemplates(double sigmaPar, double sigmaPerp);
+        // Returns the number of times that templates have been calculated or found in our cache.
+        int getNCalculated() const;
+        int getNCached() const;
+	private:
+        // Peak power Pfid(k) - Pnw(k) at each k of our transform grid.
+        std::vector<double> _peakPower;
+        // The integral of mu^n L_ell(mu) f(mu) over [-1,1], normalized to obtain multipole ell, is
+        // estimated by Sum[_moments[(3*(ell/2) + n/2)*nMu + j] f(_muNodes[j]), {j,0,nMu-1}] for an
+        // even function f.
+        std::vector<double> _muNodes, _moments;
+        // FFTLog plans for ell = 0,2,4 on a shared grid.
+        std::vector<FFTLogPtr> _plans;
+        // Our templates are tabulated using the transform grid points _rFirst to _rLast.
+        int _rFirst, _rLast;
+        typedef std::map<std::pair<double,double>,UniformSplinePtr> TemplateCache;
+        TemplateCache _cache;
+        int _nCalculated, _nCached;
+	}; // PeakBroadening
+
+    inline int PeakBroadening::getNCalculated() const { return _nCalculated; }
+    inline int PeakBroadening::getNCached() const { return _nCached; }
+
+} // baofit
+
+#endif // BAOFIT_PEAK_BROADENING
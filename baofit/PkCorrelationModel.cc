@@ -2,24 +2,174 @@
 
 #include "baofit/PkCorrelationModel.h"
 #include "baofit/RuntimeError.h"
+#include "baofit/EvaluationContext.h"
+#include "baofit/FitProfile.h"
+#include "baofit/ModelPack.h"
+#include "baofit/UniformSpline.h"
+#include "baofit/sineIntegral.h"
 
-#include "likely/Interpolator.h"
-#include "likely/function.h"
 #include "likely/RuntimeError.h"
 
 #include "boost/format.hpp"
 
-#include "gsl/gsl_sf_expint.h"
-
 #include <fstream>
+#include <iostream>
 #include <cmath>
+#include <algorithm>
 
 namespace local = baofit;
 
+namespace baofit {
+namespace pk {
+    // Maximum memory used to cache sine integrals, after which the cache starts over.
+    std::size_t const maxCacheBytes = 64 << 20;
+    // Fills E[j] for j = 0..nj-1 with the transform to multipole Ell at separation r of the
+    // B-spline of the specified order whose support starts at knot kj = klo + j*dk, using the
+    // sin(kj*r), cos(kj*r) and Si(kj*r) values tabulated at each knot. Only the specializations
+    // for Order = 0,1,3 and Ell = 0,2,4 below are implemented, and they have no branches so that
+    // their loops over knots can be vectorized.
+    template <int Order, int Ell> void getE(int nj, double r, double klo, double dk, double const *sinkr,
+        double const *coskr, double const *sikr, double *E);
+    template <> void getE<3,0>(int nj, double r, double klo, double dk, double const *sinkr,
+    double const *coskr, double const *sikr, double *E) {
+        double dk2(dk*dk), dk3(dk2*dk), r2(r*r), r3(r2*r), r5(r3*r2);
+        for(int j = 0; j < nj; ++j) {
+            E[j] = (sinkr[j] - 4*sinkr[j+1] + 6*sinkr[j+2] - 4*sinkr[j+3] + sinkr[j+4])/(dk3*r5);
+        }
+    }
+
+    template <> void getE<3,2>(int nj, double r, double klo, double dk, double const *sinkr,
+    double const *coskr, double const *sikr, double *E) {
+        double dk2(dk*dk), dk3(dk2*dk), r2(r*r), r3(r2*r), r5(r3*r2);
+        for(int j = 0; j < nj; ++j) {
+            double kj = klo + dk*j, kj2(kj*kj);
+            E[j] = -(3*kj*r*coskr[j] - 12*dk*r*coskr[j+1] - 12*kj*r*coskr[j+1] + 36*dk*r*coskr[j+2] + 18*kj*r*coskr[j+2] -
+                36*dk*r*coskr[j+3] - 12*kj*r*coskr[j+3] + 12*dk*r*coskr[j+4] + 3*kj*r*coskr[j+4] + 5*sinkr[j] -
+                20*sinkr[j+1] + 30*sinkr[j+2] - 20*sinkr[j+3] + 5*sinkr[j+4] +
+                3*kj2*r2*sikr[j] -
+                12*(dk2+2*dk*kj+kj2)*r2*sikr[j+1] +
+                72*dk2*r2*sikr[j+2] + 72*dk*kj*r2*sikr[j+2] + 18*kj2*r2*sikr[j+2] -
+                108*dk2*r2*sikr[j+3] - 72*dk*kj*r2*sikr[j+3] - 12*kj2*r2*sikr[j+3] +
+                48*dk2*r2*sikr[j+4] + 24*dk*kj*r2*sikr[j+4] + 3*kj2*r2*sikr[j+4]
+                )/(2.*dk3*r5);
+        }
+    }
+
+    template <> void getE<3,4>(int nj, double r, double klo, double dk, double const *sinkr,
+    double const *coskr, double const *sikr, double *E) {
+        double dk2(dk*dk), dk3(dk2*dk), r2(r*r), r3(r2*r), r5(r3*r2);
+        for(int j = 0; j < nj; ++j) {
+            double kj = klo + dk*j, kj2(kj*kj);
+            E[j] = -(15*kj*r*coskr[j] - 60*dk*r*coskr[j+1] - 60*kj*r*coskr[j+1] + 180*dk*r*coskr[j+2] + 90*kj*r*coskr[j+2] -
+                180*dk*r*coskr[j+3] - 60*kj*r*coskr[j+3] + 60*dk*r*coskr[j+4] + 15*kj*r*coskr[j+4] + 11*sinkr[j] -
+                44*sinkr[j+1] + 66*sinkr[j+2] - 44*sinkr[j+3] + 11*sinkr[j+4] +
+                5*(14 + 3*kj2*r2)*sikr[j] -
+                20*(14 + 3*dk2*r2 + 6*dk*kj*r2 + 3*kj2*r2)*sikr[j+1] +
+                420*sikr[j+2] + 360*dk2*r2*sikr[j+2] + 360*dk*kj*r2*sikr[j+2] + 90*kj2*r2*sikr[j+2] -
+                280*sikr[j+3] - 540*dk2*r2*sikr[j+3] - 360*dk*kj*r2*sikr[j+3] - 60*kj2*r2*sikr[j+3] +
+                70*sikr[j+4] + 240*dk2*r2*sikr[j+4] + 120*dk*kj*r2*sikr[j+4] + 15*kj2*r2*sikr[j+4]
+                )/(4.*dk3*r5);
+        }
+    }
+
+    template <> void getE<1,0>(int nj, double r, double klo, double dk, double const *sinkr,
+    double const *coskr, double const *sikr, double *E) {
+        double r2(r*r), r3(r2*r);
+        for(int j = 0; j < nj; ++j) {
+            E[j] = -((sinkr[j] - 2*sinkr[j+1] + sinkr[j+2])/(dk*r3));
+        }
+    }
+
+    template <> void getE<1,2>(int nj, double r, double klo, double dk, double const *sinkr,
+    double const *coskr, double const *sikr, double *E) {
+        double r2(r*r), r3(r2*r);
+        for(int j = 0; j < nj; ++j) {
+            E[j] = (sinkr[j] - 2*sinkr[j+1] + sinkr[j+2] - 3*sikr[j] + 6*sikr[j+1] - 3*sikr[j+2])/(dk*r3);
+        }
+    }
+
+    template <> void getE<1,4>(int nj, double r, double klo, double dk, double const *sinkr,
+    double const *coskr, double const *sikr, double *E) {
+        double dk2(dk*dk), dk3(dk2*dk), dk4(dk2*dk2), r2(r*r), r3(r2*r), r5(r3*r2);
+        for(int j = 0; j < nj; ++j) {
+            double kj = klo + dk*j, kj2(kj*kj), kj3(kj2*kj), kj4(kj2*kj2), kj5(kj3*kj2), kj6(kj3*kj3);
+            double tmp = 2*dk2 + 3*dk*kj + kj2;
+            double kjj = kj + dk, kjjj = kjj + dk;
+            E[j] = -(140*dk4*kj*r*coskr[j] + 420*dk3*kj2*r*coskr[j] + 455*dk2*kj3*r*coskr[j] + 210*dk*kj4*r*coskr[j] +
+                35*kj5*r*coskr[j] - 280*dk3*kj2*r*coskr[j+1] - 560*dk2*kj3*r*coskr[j+1] -
+                350*dk*kj4*r*coskr[j+1] - 70*kj5*r*coskr[j+1] + 70*dk3*kj2*r*coskr[j+2] +
+                175*dk2*kj3*r*coskr[j+2] + 140*dk*kj4*r*coskr[j+2] + 35*kj5*r*coskr[j+2] -
+                140*dk4*sinkr[j] - 420*dk3*kj*sinkr[j] - 455*dk2*kj2*sinkr[j] - 210*dk*kj3*sinkr[j] -
+                35*kj4*sinkr[j] + 8*dk4*kj2*r2*sinkr[j] + 24*dk3*kj3*r2*sinkr[j] +
+                26*dk2*kj4*r2*sinkr[j] + 12*dk*kj5*r2*sinkr[j] + 2*kj6*r2*sinkr[j] +
+                280*dk2*kj2*sinkr[j+1] + 280*dk*kj3*sinkr[j+1] + 70*kj4*sinkr[j+1] -
+                16*dk4*kj2*r2*sinkr[j+1] - 48*dk3*kj3*r2*sinkr[j+1] -
+                52*dk2*kj4*r2*sinkr[j+1] - 24*dk*kj5*r2*sinkr[j+1] -
+                4*kj6*r2*sinkr[j+1] - 35*dk2*kj2*sinkr[j+2] - 70*dk*kj3*sinkr[j+2] -
+                35*kj4*sinkr[j+2] + 8*dk4*kj2*r2*sinkr[j+2] +
+                24*dk3*kj3*r2*sinkr[j+2] + 26*dk2*kj4*r2*sinkr[j+2] +
+                12*dk*kj5*r2*sinkr[j+2] + 2*kj6*r2*sinkr[j+2] +
+                15*kj2*tmp*tmp*r2*sikr[j] -
+                30*kj2*tmp*tmp*r2*sikr[j+1] +
+                60*dk4*kj2*r2*sikr[j+2] + 180*dk3*kj3*r2*sikr[j+2] +
+                195*dk2*kj4*r2*sikr[j+2] + 90*dk*kj5*r2*sikr[j+2] +
+                15*kj6*r2*sikr[j+2])/(2.*dk*kj2*kjj*kjj*kjjj*kjjj*r5);
+        }
+    }
+
+    template <> void getE<0,0>(int nj, double r, double klo, double dk, double const *sinkr,
+    double const *coskr, double const *sikr, double *E) {
+        double r2(r*r);
+        for(int j = 0; j < nj; ++j) {
+            E[j] = (coskr[j] - coskr[j+1])/r2;
+        }
+    }
+
+    template <> void getE<0,2>(int nj, double r, double klo, double dk, double const *sinkr,
+    double const *coskr, double const *sikr, double *E) {
+        double r2(r*r), r3(r2*r);
+        for(int j = 0; j < nj; ++j) {
+            double kj = klo + dk*j;
+            E[j] = (-(kj*(dk + kj)*r*coskr[j]) + kj*(dk + kj)*r*coskr[j+1] + 3*((dk + kj)*sinkr[j] -
+                kj*sinkr[j+1]))/(kj*(dk + kj)*r3);
+        }
+    }
+
+    template <> void getE<0,4>(int nj, double r, double klo, double dk, double const *sinkr,
+    double const *coskr, double const *sikr, double *E) {
+        double dk2(dk*dk), r2(r*r), r3(r2*r), r5(r3*r2);
+        for(int j = 0; j < nj; ++j) {
+            double kj = klo + dk*j, kj2(kj*kj), kj3(kj2*kj);
+            double kjj = kj + dk, kjj3 = kjj*kjj*kjj;
+            E[j] = (kj*kjj3*r*(-35 + kj2*r2)*coskr[j] - kj3*(dk + kj)*r*(-35 + dk2*r2 + 2*dk*kj*r2 + kj2*r2)*coskr[j+1] -
+                5*(kjj3*(-7 + 2*kj2*r2)*sinkr[j] - kj3*(-7 + 2*dk2*r2 + 4*dk*kj*r2 + 2*kj2*r2)*sinkr[j+1]))/(kj3*kjj3*r5);
+        }
+    }
+    // Returns the B-spline of the specified order at 0 <= t <= 1 in units of its support. Only
+    // the specializations for Order = 0,1,3 below are implemented.
+    template <int Order> double getB(double t);
+    template <> double getB<0>(double t) {
+        return 1;
+    }
+    template <> double getB<1>(double t) {
+        // Use symmetry to put 0 <= t <= 1/2
+        t = std::min(t,1-t);
+        return 2*t;
+    }
+    template <> double getB<3>(double t) {
+        // Use symmetry to put 0 <= t <= 1/2
+        t = std::min(t,1-t);
+        double inner((32./3.)*t*t*t), outer((2./3.) - 8*t*(1 - 4*t*(1 - t)));
+        return (t < 0.25) ? inner : outer;
+    }
+}} // baofit::pk
+
 local::PkCorrelationModel::PkCorrelationModel(std::string const &modelrootName, std::string const &nowigglesName,
-double klo, double khi, int nk, int splineOrder, bool independentMultipoles, double zref)
+double klo, double khi, int nk, int splineOrder, bool independentMultipoles, double zref,
+double templateAccuracy, std::string const &modelPackName)
 : AbsCorrelationModel("P(ell,k) Correlation Model"), _klo(klo), _nk(nk), _splineOrder(splineOrder),
-_independentMultipoles(independentMultipoles)
+_independentMultipoles(independentMultipoles), _nCacheHits(0), _nCacheMisses(0),
+_validateSineIntegrals(false), _maxSineIntegralError(0)
 {
     // Check inputs.
     if(klo >= khi) throw RuntimeError("PkCorrelationModel: expected khi > klo.");
@@ -28,17 +178,32 @@ _independentMultipoles(independentMultipoles)
     if(splineOrder != 0 && splineOrder != 1 && splineOrder != 3) {
         throw RuntimeError("PkCorrelationModel: only splineOrder = 0,1,3 are implemented so far.");
     }
+    // Select the kernels for our spline order.
+    if(splineOrder == 3) {
+        _basisKernel[0] = &pk::getE<3,0>;
+        _basisKernel[1] = &pk::getE<3,2>;
+        _basisKernel[2] = &pk::getE<3,4>;
+        _splineKernel = &pk::getB<3>;
+    }
+    else if(splineOrder == 1) {
+        _basisKernel[0] = &pk::getE<1,0>;
+        _basisKernel[1] = &pk::getE<1,2>;
+        _basisKernel[2] = &pk::getE<1,4>;
+        _splineKernel = &pk::getB<1>;
+    }
+    else {
+        _basisKernel[0] = &pk::getE<0,0>;
+        _basisKernel[1] = &pk::getE<0,2>;
+        _basisKernel[2] = &pk::getE<0,4>;
+        _splineKernel = &pk::getB<0>;
+    }
     // Precompute useful quantities
     _dk = (khi - klo)/(nk - 1);
     _dk2 = _dk*_dk;
     _dk3 = _dk2*_dk;
     _dk4 = _dk2*_dk2;
-    _rsave = -1;
     double pi(4*std::atan(1));
     _twopisq = 2*pi*pi;
-    _sinInt.resize(nk);
-    _sin.resize(nk);
-    _cos.resize(nk);
     // Linear bias parameters
     _indexBase = 1 + _defineLinearBiasParameters(zref);
     // B-spline coefficients for each multipole.
@@ -49,51 +214,61 @@ _independentMultipoles(independentMultipoles)
             defineParameter(boost::str(name % ell % j),0,0.1);
         }
     }
-    // Load the interpolation data for the specified no-wiggles model.
-    std::string root(modelrootName);
-    if(0 < root.size() && root[root.size()-1] != '/') root += '/';
-    boost::format powerName("%s%s_matterpower.dat"),fileName("%s%s.%d.dat");
-    std::string method("cspline");
+    _coefs.resize(getNParameters() - _indexBase);
+    // Load the interpolation data for the specified no-wiggles model, either from a precompiled
+    // model pack or else from text files.
     try {
-        _nwPower = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(powerName % root % nowigglesName),method));
-        _nw0 = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(fileName % root % nowigglesName % 0),method));
-        _nw2 = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(fileName % root % nowigglesName % 2),method));
-        _nw4 = likely::createFunctionPtr(likely::createInterpolator(
-            boost::str(fileName % root % nowigglesName % 4),method));
+        if(modelPackName.length() > 0) {
+            std::string root(modelrootName);
+            if(0 < root.size() && root[root.size()-1] != '/') root += '/';
+            ModelPack pack(root + modelPackName);
+            if(nowigglesName.length() > 0 && nowigglesName != pack.getNoWigglesName()) {
+                throw RuntimeError("PkCorrelationModel: model pack was created for a different model.");
+            }
+            _nwMultipoles = pack.getNoWigglesMultipoles();
+            _nwPower = pack.getNoWigglesPower();
+        }
+        else {
+            _nwMultipoles = ModelPack::readMultipoles(modelrootName,nowigglesName,templateAccuracy);
+            _nwPower = ModelPack::readPower(modelrootName,nowigglesName,templateAccuracy);
+        }
     }
     catch(likely::RuntimeError const &e) {
         throw RuntimeError("PkCorrelationModel: error while reading model interpolation data.");
     }
-    {
-        /**
-        // Debug output to compare with Mathematica results
-        int j = 2;
-        double kj = _klo + _dk*j, r = 100;
-        _fillCache(r);
-        std::cout << "EE0" << _splineOrder << '[' << kj << ',' << _dk << ",100] = "
-            << _getE(j,r,cosmo::Monopole) << std::endl;
-        std::cout << "EE2" << _splineOrder << '[' << kj << ',' << _dk << ",100] = "
-            << _getE(j,r,cosmo::Quadrupole) << std::endl;
-        std::cout << "EE4" << _splineOrder << '[' << kj << ',' << _dk << ",100] = "
-            << _getE(j,r,cosmo::Hexadecapole) << std::endl;
-        **/
-    }
 }
 
 local::PkCorrelationModel::~PkCorrelationModel() { }
 
-void local::PkCorrelationModel::_fillCache(double r) const {
-    if(r == _rsave) return;
-    for(int j = 0; j < _nk; ++j) {
-        double kj = _klo + _dk*j;
-        _sin[j] = std::sin(kj*r);
-        _cos[j] = std::cos(kj*r);
-        _sinInt[j] = gsl_sf_Si(kj*r);
+local::PkCorrelationModel::Workspace local::PkCorrelationModel::_getWorkspace(double r) const {
+    SineIntegralCache::iterator found = _cache.find(r);
+    if(found != _cache.end()) {
+        ++_nCacheHits;
+    }
+    else {
+        // Start over if the cache is full. Map entries do not move, so this is the only way
+        // that a previously returned workspace can become invalid.
+        if(_cache.size()*3*_nk*sizeof(double) >= pk::maxCacheBytes) _cache.clear();
+        found = _cache.insert(std::make_pair(r,std::vector<double>(3*_nk))).first;
+        double *values = &found->second[0];
+        getSineIntegrals(_nk,_klo*r,_dk*r,values,values+_nk,values+2*_nk);
+        if(_validateSineIntegrals) {
+            std::vector<double> x(_nk);
+            for(int j = 0; j < _nk; ++j) x[j] = _klo*r + j*_dk*r;
+            double error = compareSineIntegrals(_nk,&x[0],values+2*_nk);
+            if(error > _maxSineIntegralError) _maxSineIntegralError = error;
+            if(error > sineIntegralAccuracy) {
+                throw RuntimeError(boost::str(boost::format(
+                    "PkCorrelationModel: sine integrals for r = %g differ from gsl_sf_Si by %g.") % r % error));
+            }
+        }
+        ++_nCacheMisses;
     }
-    _rsave = r;
+    Workspace workspace;
+    workspace.sin = &found->second[0];
+    workspace.cos = workspace.sin + _nk;
+    workspace.sinInt = workspace.cos + _nk;
+    return workspace;
 }
 
 double local::PkCorrelationModel::_getB(int j, double k) const {
@@ -101,156 +276,173 @@ double local::PkCorrelationModel::_getB(int j, double k) const {
     if(k <= kj) return 0;
     double t = (k - kj)/((_splineOrder+1)*_dk);
     if(t > 1) return 0;
-    // Use symmetry to put 0 < t <= 1/2
-    if(t > 0.5) t = 1-t;
-    double result(0);
-    if(_splineOrder == 3) {
-        if(t < 0.25) {
-            result = (32./3.)*t*t*t;
-        }
-        else { // t <= 1/2
-            result = (2./3.) - 8*t*(1 - 4*t*(1 - t));
-        }
-    }
-    else if(_splineOrder == 1) {
-        result = 2*t;
-    }
-    else { // _splineOrder == 0
-        return 1;
+    return _splineKernel(t);
+}
+
+void local::PkCorrelationModel::_prepareEvaluation(bool anyChanged) {
+    // Lookup the spline coefficients once for all batches.
+    int ncoefs = _coefs.size();
+    for(int index = 0; index < ncoefs; ++index) {
+        _coefs[index] = getParameterValue(_indexBase + index);
     }
+}
+
+double local::PkCorrelationModel::_evaluate(double r, double mu, double z, bool anyChanged) const {
+    double result;
+    bindRange(1,&r,&mu,&z,_getDefaultContext());
+    _evaluateBatch(1,&r,&mu,&z,&result,_getDefaultContext());
     return result;
 }
 
-double local::PkCorrelationModel::_getE(int j, double r, cosmo::Multipole multipole) const {
-    double kj = _klo + _dk*j;
-    double r2(r*r),r3(r2*r),r5(r3*r2),kj2(kj*kj),kj3(kj2*kj),kj4(kj2*kj2),kj5(kj3*kj2),kj6(kj3*kj3);
-    if(_splineOrder == 3) {
-        if(multipole == cosmo::Monopole) {
-            return (_sin[j] - 4*_sin[j+1] + 6*_sin[j+2] - 4*_sin[j+3] + _sin[j+4])/(_dk3*r5);
-        }
-        else if(multipole == cosmo::Quadrupole) {
-            return -(3*kj*r*_cos[j] - 12*_dk*r*_cos[j+1] - 12*kj*r*_cos[j+1] + 36*_dk*r*_cos[j+2] + 18*kj*r*_cos[j+2] - 
-                  36*_dk*r*_cos[j+3] - 12*kj*r*_cos[j+3] + 12*_dk*r*_cos[j+4] + 3*kj*r*_cos[j+4] + 5*_sin[j] - 
-                  20*_sin[j+1] + 30*_sin[j+2] - 20*_sin[j+3] + 5*_sin[j+4] +
-                  3*kj2*r2*_sinInt[j] - 
-                  12*(_dk2+2*_dk*kj+kj2)*r2*_sinInt[j+1] +
-                  72*_dk2*r2*_sinInt[j+2] + 72*_dk*kj*r2*_sinInt[j+2] + 18*kj2*r2*_sinInt[j+2] - 
-                  108*_dk2*r2*_sinInt[j+3] - 72*_dk*kj*r2*_sinInt[j+3] - 12*kj2*r2*_sinInt[j+3] +
-                  48*_dk2*r2*_sinInt[j+4] + 24*_dk*kj*r2*_sinInt[j+4] + 3*kj2*r2*_sinInt[j+4]
-                  )/(2.*_dk3*r5);
-        }
-        else { // Hexadecapole
-            return -(15*kj*r*_cos[j] - 60*_dk*r*_cos[j+1] - 60*kj*r*_cos[j+1] + 180*_dk*r*_cos[j+2] + 90*kj*r*_cos[j+2] - 
-                  180*_dk*r*_cos[j+3] - 60*kj*r*_cos[j+3] + 60*_dk*r*_cos[j+4] + 15*kj*r*_cos[j+4] + 11*_sin[j] - 
-                  44*_sin[j+1] + 66*_sin[j+2] - 44*_sin[j+3] + 11*_sin[j+4] + 
-                  5*(14 + 3*kj2*r2)*_sinInt[j] -
-                  20*(14 + 3*_dk2*r2 + 6*_dk*kj*r2 + 3*kj2*r2)*_sinInt[j+1] +
-                  420*_sinInt[j+2] + 360*_dk2*r2*_sinInt[j+2] + 360*_dk*kj*r2*_sinInt[j+2] + 90*kj2*r2*_sinInt[j+2] -
-                  280*_sinInt[j+3] - 540*_dk2*r2*_sinInt[j+3] - 360*_dk*kj*r2*_sinInt[j+3] - 60*kj2*r2*_sinInt[j+3] +
-                  70*_sinInt[j+4] + 240*_dk2*r2*_sinInt[j+4] + 120*_dk*kj*r2*_sinInt[j+4] + 15*kj2*r2*_sinInt[j+4]
-                  )/(4.*_dk3*r5);
+double local::PkCorrelationModel::_evaluate(double r, cosmo::Multipole multipole, double z,
+bool anyChanged) const {
+    double result;
+    bindRange(1,&r,&multipole,&z,_getDefaultContext());
+    _evaluateBatch(1,&r,&multipole,&z,&result,_getDefaultContext());
+    return result;
+}
+
+void local::PkCorrelationModel::_bindRange(int n, double const *r, double const *mu, double const *z,
+EvaluationContext &context) const {
+    if(n <= 0) return;
+    // Each multipole is weighted by its Legendre polynomial in mu.
+    double const *L2 = _getLegendreWeights(context), *L4 = L2 + n;
+    std::vector<double> weights(3*n);
+    std::fill(weights.begin(),weights.begin() + n,1.);
+    std::copy(L2,L2 + n,weights.begin() + n);
+    std::copy(L4,L4 + n,weights.begin() + 2*n);
+    _bindBasis(n,r,&weights[0],context);
+}
+
+void local::PkCorrelationModel::_bindRange(int n, double const *r, cosmo::Multipole const *multipole,
+double const *z, EvaluationContext &context) const {
+    if(n <= 0) return;
+    // Each bin only uses its own multipole.
+    std::vector<double> weights(3*n,0.);
+    for(int i = 0; i < n; ++i) {
+        if(multipole[i] != cosmo::Monopole && multipole[i] != cosmo::Quadrupole &&
+        multipole[i] != cosmo::Hexadecapole) {
+            throw RuntimeError("PkCorrelationModel: only multipoles ell = 0,2,4 are supported.");
         }
+        weights[(multipole[i]/2)*n + i] = 1;
     }
-    else if(_splineOrder == 1) {
-        if(multipole == cosmo::Monopole) {
-            return -((_sin[j] - 2*_sin[j+1] + _sin[j+2])/(_dk*r3));
-        }
-        else if(multipole == cosmo::Quadrupole) {
-            return (_sin[j] - 2*_sin[j+1] + _sin[j+2] - 3*_sinInt[j] + 6*_sinInt[j+1] - 3*_sinInt[j+2])/(_dk*r3);
-        }
-        else { // Hexadecapole
-            double tmp = 2*_dk2 + 3*_dk*kj + kj2;
-            double kjj = kj + _dk, kjjj = kjj + _dk;
-            return -(140*_dk4*kj*r*_cos[j] + 420*_dk3*kj2*r*_cos[j] + 455*_dk2*kj3*r*_cos[j] + 210*_dk*kj4*r*_cos[j] + 
-                  35*kj5*r*_cos[j] - 280*_dk3*kj2*r*_cos[j+1] - 560*_dk2*kj3*r*_cos[j+1] - 
-                  350*_dk*kj4*r*_cos[j+1] - 70*kj5*r*_cos[j+1] + 70*_dk3*kj2*r*_cos[j+2] + 
-                  175*_dk2*kj3*r*_cos[j+2] + 140*_dk*kj4*r*_cos[j+2] + 35*kj5*r*_cos[j+2] - 
-                  140*_dk4*_sin[j] - 420*_dk3*kj*_sin[j] - 455*_dk2*kj2*_sin[j] - 210*_dk*kj3*_sin[j] - 
-                  35*kj4*_sin[j] + 8*_dk4*kj2*r2*_sin[j] + 24*_dk3*kj3*r2*_sin[j] + 
-                  26*_dk2*kj4*r2*_sin[j] + 12*_dk*kj5*r2*_sin[j] + 2*kj6*r2*_sin[j] + 
-                  280*_dk2*kj2*_sin[j+1] + 280*_dk*kj3*_sin[j+1] + 70*kj4*_sin[j+1] - 
-                  16*_dk4*kj2*r2*_sin[j+1] - 48*_dk3*kj3*r2*_sin[j+1] - 
-                  52*_dk2*kj4*r2*_sin[j+1] - 24*_dk*kj5*r2*_sin[j+1] - 
-                  4*kj6*r2*_sin[j+1] - 35*_dk2*kj2*_sin[j+2] - 70*_dk*kj3*_sin[j+2] - 
-                  35*kj4*_sin[j+2] + 8*_dk4*kj2*r2*_sin[j+2] + 
-                  24*_dk3*kj3*r2*_sin[j+2] + 26*_dk2*kj4*r2*_sin[j+2] + 
-                  12*_dk*kj5*r2*_sin[j+2] + 2*kj6*r2*_sin[j+2] + 
-                  15*kj2*tmp*tmp*r2*_sinInt[j] - 
-                  30*kj2*tmp*tmp*r2*_sinInt[j+1] + 
-                  60*_dk4*kj2*r2*_sinInt[j+2] + 180*_dk3*kj3*r2*_sinInt[j+2] + 
-                  195*_dk2*kj4*r2*_sinInt[j+2] + 90*_dk*kj5*r2*_sinInt[j+2] + 
-                  15*kj6*r2*_sinInt[j+2])/(2.*_dk*kj2*kjj*kjj*kjjj*kjjj*r5);
+    _bindBasis(n,r,&weights[0],context);
+}
+
+void local::PkCorrelationModel::_bindBasis(int n, double const *r, double const *weights,
+EvaluationContext &context) const {
+    FitProfile *profile = context.getProfile();
+    double start(profile ? FitProfile::getWallTime() : 0);
+    int nj = _nk-_splineOrder-1;
+    // Our no-wiggles multipoles clamp their argument, so check the range of r once here.
+    if(n > 0) {
+        double rmin(*std::min_element(r,r+n)), rmax(*std::max_element(r,r+n));
+        if(!(rmin >= _nwMultipoles->getXMin() && rmax <= _nwMultipoles->getXMax())) {
+            throw RuntimeError(boost::str(boost::format(
+                "PkCorrelationModel: separations [%g,%g] Mpc/h are outside the tabulated range [%g,%g] Mpc/h.")
+                % rmin % rmax % _nwMultipoles->getXMin() % _nwMultipoles->getXMax()));
         }
     }
-    else { // _splineOrder == 0
-        if(multipole == cosmo::Monopole) {
-            return (_cos[j] - _cos[j+1])/r2;
-        }
-        else if(multipole == cosmo::Quadrupole) {
-            return (-(kj*(_dk + kj)*r*_cos[j]) + kj*(_dk + kj)*r*_cos[j+1] + 3*((_dk + kj)*_sin[j] -
-                kj*_sin[j+1]))/(kj*(_dk + kj)*r3);
-        }
-        else { // Hexadecapole
-            double kjj = kj + _dk, kjj3 = kjj*kjj*kjj;
-            return (kj*kjj3*r*(-35 + kj2*r2)*_cos[j] - kj3*(_dk + kj)*r*(-35 + _dk2*r2 + 2*_dk*kj*r2 + kj2*r2)*_cos[j+1] - 
-                 5*(kjj3*(-7 + 2*kj2*r2)*_sin[j] - kj3*(-7 + 2*_dk2*r2 + 4*_dk*kj*r2 + 2*kj2*r2)*_sin[j+1]))/(kj3*kjj3*r5);
+    std::vector<double> &smooth = context.getBuffer(this,SMOOTH);
+    std::vector<double> &basis = context.getBuffer(this,BASIS);
+    smooth.resize(3*n);
+    basis.resize(3*nj*n);
+    context.getBuffer(this,MULTIPOLES).resize(3*n);
+    // Lock our cache of expensive sine integrals in case another thread is also binding.
+    boost::mutex::scoped_lock lock(_cacheMutex);
+    // The quadrupole of the splined interpolation has the opposite sign.
+    double const sign[3] = { 1, -1, 1 };
+    double nw[3];
+    std::vector<double> E(nj);
+    for(int i = 0; i < n; ++i) {
+        Workspace workspace = _getWorkspace(r[i]);
+        _nwMultipoles->evaluate(r[i],nw);
+        for(int b = 0; b < 3; ++b) {
+            double weight = weights[b*n + i];
+            smooth[b*n + i] = weight*nw[b];
+            double *column = &basis[b*nj*n + i];
+            if(0 == weight) {
+                for(int j = 0; j < nj; ++j) column[j*n] = 0;
+                continue;
+            }
+            // Calculate this multipole for all knots at once, then scale and store it.
+            _basisKernel[b](nj,r[i],_klo,_dk,workspace.sin,workspace.cos,workspace.sinInt,&E[0]);
+            double scale = weight*sign[b]/_twopisq;
+            for(int j = 0; j < nj; ++j) column[j*n] = scale*E[j];
         }
-        
     }
+    if(profile) profile->addTerm("pk-basis",false,FitProfile::getWallTime() - start);
 }
 
-double local::PkCorrelationModel::_xi(double r, cosmo::Multipole multipole) const {
-    // Evaluate the smooth baseline model.
-    double xi(0), sign(1), twopisq();
-    int nj = _nk-_splineOrder-1, offset = _indexBase;
-    switch(multipole) {
-    case cosmo::Monopole:
-        xi = (*_nw0)(r);
-        break;
-    case cosmo::Quadrupole:
-        xi = (*_nw2)(r);
-        if(_independentMultipoles) offset += nj;
-        sign = -1;
-        break;
-    case cosmo::Hexadecapole:
-        xi = (*_nw4)(r);
-        if(_independentMultipoles) offset += 2*nj;
-        break;
+void local::PkCorrelationModel::_evaluateBasis(int n, double const *z, double *result,
+EvaluationContext &context) const {
+    FitProfile *profile = context.getProfile();
+    double start(profile ? FitProfile::getWallTime() : 0);
+    int nj = _nk-_splineOrder-1;
+    double const *smooth = &context.getBuffer(this,SMOOTH)[0];
+    double const *basis = &context.getBuffer(this,BASIS)[0];
+    double *xi = &context.getBuffer(this,MULTIPOLES)[0];
+    // Add the splined interpolation to the smooth baseline model of each multipole, as the
+    // product of the basis matrix with the spline coefficients.
+    std::copy(smooth,smooth + 3*n,xi);
+    for(int b = 0; b < 3; ++b) {
+        double const *coefs = &_coefs[_independentMultipoles ? b*nj : 0];
+        double *xib = xi + b*n;
+        for(int j = 0; j < nj; ++j) {
+            double coef(coefs[j]);
+            if(0 == coef) continue;
+            double const *column = basis + (b*nj + j)*n;
+            for(int i = 0; i < n; ++i) xib[i] += coef*column[i];
+        }
     }
-    // Add the splined interpolation.
-    for(int j = 0; j < nj; ++j) {
-        xi += sign/_twopisq*getParameterValue(offset+j)*_getE(j,r,multipole);
+    // Put the pieces together.
+    for(int i = 0; i < n; ++i) {
+        double const *norm = _getRedshiftFactors(z[i],context);
+        result[i] = norm[NORM0]*xi[i] + norm[NORM2]*xi[n+i] + norm[NORM4]*xi[2*n+i];
     }
-    return xi;
+    if(profile) profile->addTerm("pk-multipoles",false,FitProfile::getWallTime() - start);
 }
 
-double local::PkCorrelationModel::_evaluate(double r, double mu, double z, bool anyChanged) const {
-    // Cache expensive sine integrals.
-    _fillCache(r);
-    // Calculate the Legendre weights.
-    double muSq(mu*mu);
-    double L0(1), L2 = (3*muSq - 1)/2., L4 = (35*muSq*muSq - 30*muSq + 3)/8.;
-    // Put the pieces together.
-    return
-        _getNormFactor(cosmo::Monopole,z)*L0*_xi(r,cosmo::Monopole) +
-        _getNormFactor(cosmo::Quadrupole,z)*L2*_xi(r,cosmo::Quadrupole) +
-        _getNormFactor(cosmo::Hexadecapole,z)*L4*_xi(r,cosmo::Hexadecapole);
+void local::PkCorrelationModel::_evaluateBatch(int n, double const *r, double const *mu, double const *z,
+double *result, EvaluationContext &context) const {
+    if(n <= 0) return;
+    _evaluateBasis(n,z,result,context);
 }
 
-double local::PkCorrelationModel::_evaluate(double r, cosmo::Multipole multipole, double z,
-bool anyChanged) const {
-    // Cache expensive sine integrals.
-    _fillCache(r);
-    return _getNormFactor(multipole,z)*_xi(r,multipole);
+void local::PkCorrelationModel::_evaluateBatch(int n, double const *r, cosmo::Multipole const *multipole,
+double const *z, double *result, EvaluationContext &context) const {
+    if(n <= 0) return;
+    _evaluateBasis(n,z,result,context);
 }
 
 void  local::PkCorrelationModel::printToStream(std::ostream &out, std::string const &formatSpec) const {
     AbsCorrelationModel::printToStream(out,formatSpec);
+    printCacheStatistics(out);
+}
+
+void local::PkCorrelationModel::printCacheStatistics(std::ostream &out) const {
+    boost::mutex::scoped_lock lock(_cacheMutex);
+    long total = _nCacheHits + _nCacheMisses;
+    out << boost::format("Sine integral cache has %d radii (%.1f Mb) with %d hits and %d misses (%.1f%% hit rate).")
+        % _cache.size() % (_cache.size()*3*_nk*sizeof(double)/1048576.) % _nCacheHits % _nCacheMisses
+        % (total > 0 ? (100.*_nCacheHits)/total : 0) << std::endl;
+    if(_validateSineIntegrals) {
+        out << boost::format("Largest sine integral difference from gsl_sf_Si beyond its error estimate is %g (limit %g).")
+            % _maxSineIntegralError % sineIntegralAccuracy << std::endl;
+    }
+}
+
+void local::PkCorrelationModel::setSineIntegralValidation(bool validate) {
+    boost::mutex::scoped_lock lock(_cacheMutex);
+    _validateSineIntegrals = validate;
 }
 
 void local::PkCorrelationModel::dump(std::string const &dumpName, double kmin, double kmax, int nk,
 likely::Parameters const &params, double zref) {
     if(kmax <= kmin || nk <= 2) throw RuntimeError("PkCorrelationModel::dump: bad inputs (kmin,kmax,nk).");
+    if(kmin < _nwPower->getXMin() || kmax > _nwPower->getXMax()) {
+        throw RuntimeError("PkCorrelationModel::dump: k range is outside the tabulated no-wiggles power.");
+    }
     // Open the requested file.
     std::ofstream out(dumpName.c_str());
     // Load the requested parameters.
@@ -4,10 +4,17 @@
 #define BAOFIT_PK_CORRELATION_MODEL
 
 #include "baofit/AbsCorrelationModel.h"
+#include "baofit/types.h"
+
+#include "likely/types.h"
 
 #include "cosmo/types.h"
 
+#include "boost/thread/mutex.hpp"
+
+#include <map>
 #include <vector>
+#include <iosfwd>
 
 namespace baofit {
 	// Represents a two-point correlation model parameterized in k space as a band-limited interpolated
@@ -16,12 +23,22 @@ namespace baofit {
 	public:
 	    // Creates a new correlation model parameterized as the sum of the specified tabulated smooth model
 	    // with a uniform B-spline in k*P(ell,k) added to each k-space multipole, with nk uniformly spaced
-	    // knots spanning the range (klo,khi) in h/Mpc.
+	    // knots spanning the range (klo,khi) in h/Mpc. The smooth model is interpolated to the specified
+	    // relative accuracy, unless a model pack is specified, in which case its precomputed tables are
+	    // used instead.
 		PkCorrelationModel(std::string const &modelrootName, std::string const &nowigglesName,
-		    double klo, double khi, int nk, int splineOrder, bool independentMultipoles, double zref);
+		    double klo, double khi, int nk, int splineOrder, bool independentMultipoles, double zref,
+		    double templateAccuracy = 1e-6, std::string const &modelPackName = "");
 		virtual ~PkCorrelationModel();
         // Prints a multi-line description of this object to the specified output stream.
         virtual void printToStream(std::ostream &out, std::string const &formatSpec = "%12.6f") const;
+        // Prints the size and hit rate of our cache of the sine integrals for each distinct radius.
+        void printCacheStatistics(std::ostream &out) const;
+        // Compares each new set of sine integrals with gsl_sf_Si when validate is true, and throws
+        // a RuntimeError if any value differs by more than sineIntegralAccuracy plus the error GSL
+        // estimates for its own value, which makes baofit --validate-si fail. The
+        // largest difference found is reported by printCacheStatistics.
+        void setSineIntegralValidation(bool validate);
         // Dumps tabulated values of the k*P(k,zref) multipoles associated with the specified parameters
         // to a file with the specified name. Values are tabulated in nk steps covering kmin-kmax. Each
         // line consists of: k k*P0(k) k*P2(k) k*P4(k) k*dP0(k) k*dP2(k) k*dP4(k) with h/Mpc units.
@@ -37,19 +54,62 @@ namespace baofit {
         // Returns the correlation function for the specified multipole at co-moving pair separation
         // r and average pair redshift z.
         virtual double _evaluate(double r, cosmo::Multipole multipole, double z, bool anyChanged) const;
+        // Loads our spline coefficients from the current parameter values.
+        virtual void _prepareEvaluation(bool anyChanged);
+        // Tabulates the smooth model and the spline basis functions for each bin, weighted by
+        // the Legendre polynomials of mu or by the multipole of each bin. None of these depend
+        // on parameter values, so evaluations only need matrix-vector products.
+        virtual void _bindRange(int n, double const *r, double const *mu, double const *z,
+            EvaluationContext &context) const;
+        virtual void _bindRange(int n, double const *r, cosmo::Multipole const *multipole,
+            double const *z, EvaluationContext &context) const;
+        // Batch versions of the methods above that fill result[0..n-1].
+        virtual void _evaluateBatch(int n, double const *r, double const *mu, double const *z,
+            double *result, EvaluationContext &context) const;
+        virtual void _evaluateBatch(int n, double const *r, cosmo::Multipole const *multipole,
+            double const *z, double *result, EvaluationContext &context) const;
 	private:
-        double _xi(double r, cosmo::Multipole multipole) const;
-        double _getE(int j, double r, cosmo::Multipole multipole) const;
+        // Pointers to the sin(kj*r), cos(kj*r) and Si(kj*r) values at one r value that _bindBasis
+        // passes to the templated basis transform kernels in _basisKernel.
+        struct Workspace {
+            double const *sin, *cos, *sinInt;
+        };
+        // Returns the workspace for the specified r value, calculating its values unless they are
+        // already cached. The caller must hold a lock on _cacheMutex while using the result.
+        Workspace _getWorkspace(double r) const;
+        // Kernels that tabulate the transform of each basis function to multipole ell = 0,2,4 for all
+        // knots at one r, and evaluate a B-spline in units of its support, for our spline order.
+        // These are selected at construction so that our inner loops do not depend on the order.
+        typedef void (*BasisKernel)(int nj, double r, double klo, double dk, double const *sinkr,
+            double const *coskr, double const *sikr, double *E);
+        BasisKernel _basisKernel[3];
+        double (*_splineKernel)(double t);
+        // Fills the context buffers used by _evaluateBasis for bins that combine their ell = 0,2,4
+        // multipoles with weights[0..n-1], weights[n..2n-1] and weights[2n..3n-1], respectively.
+        void _bindBasis(int n, double const *r, double const *weights, EvaluationContext &context) const;
+        // Fills result[0..n-1] with our prediction for the bins prepared by _bindBasis.
+        void _evaluateBasis(int n, double const *z, double *result, EvaluationContext &context) const;
+        // Context buffers prepared by _bindBasis: the weighted smooth multipoles of each bin in
+        // SMOOTH[(ell/2)*n+i], the weighted spline basis functions in BASIS[((ell/2)*nj+j)*n+i]
+        // for each coefficient j, and scratch space for the multipoles in MULTIPOLES.
+        enum { SMOOTH = 0, BASIS = 1, MULTIPOLES = 2 };
         double _getB(int j, double k) const;
-        void _fillCache(double r) const;
-	    mutable std::vector<double> _sinInt, _sin, _cos;
-        mutable double _rsave;
+	    std::vector<double> _coefs;
         int _nk, _splineOrder, _indexBase;
         double _klo, _dk, _dk2, _dk3, _dk4, _twopisq;
         bool _independentMultipoles;
-        cosmo::PowerSpectrumPtr _nwPower;
-	    cosmo::CorrelationFunctionPtr _nw0,_nw2,_nw4;
-        mutable double _norm0, _norm2, _norm4;
+        // Tabulated multipoles (ell=0,2,4) and power spectrum of the smooth model. These are never
+        // modified after construction so they are safely shared by all contexts.
+        UniformSplinePtr _nwMultipoles, _nwPower;
+        // Cache of the [ sin[nk], cos[nk], sinInt[nk] ] values for each distinct r value that we
+        // have been bound to, shared by all contexts since the same radii are usually bound many
+        // times during a run (once per fitter and by every model dump).
+        typedef std::map<double,std::vector<double> > SineIntegralCache;
+        mutable SineIntegralCache _cache;
+        mutable long _nCacheHits, _nCacheMisses;
+        bool _validateSineIntegrals;
+        mutable double _maxSineIntegralError;
+        mutable boost::mutex _cacheMutex;
 	}; // PkCorrelationModel
 } // baofit
 
@@ -2,12 +2,15 @@
 
 #include "baofit/QuasarCorrelationData.h"
 #include "baofit/RuntimeError.h"
+#include "baofit/quadrature.h"
 
 #include "cosmo/AbsHomogeneousUniverse.h"
 
 #include "likely/AbsBinning.h"
 
 #include <cmath>
+#include <map>
+#include <utility>
 
 namespace local = baofit;
 
@@ -63,40 +66,44 @@ void local::QuasarCorrelationData::fixCovariance(double ll0, double c0, double c
     // Make sure that our our data vector is un-weighted so that the changes we make to
     // the covariance matrix are correctly reflected in future values of Cinv.d
     unweightData();
+    // The inverse of our modified covariance will not have the same nonzero elements.
+    forgetInverseCovarianceElements();
 
-    // Save values in the outer loop, for re-use in the inner loop.
-    std::vector<double> dll;
-    dll.reserve(getNBinsWithData());
-    std::vector<int> bin(3);
-    
     // Lookup the binning along the log-lambda axis.
     likely::AbsBinningCPtr llBins(getAxisBinning()[0]);
 
-    // Loop over all bins.
-    for(IndexIterator iter1 = begin(); iter1 != end(); ++iter1) {
-        int i1(*iter1);
-        // Remember the indices of this 3D bin along our sep,z axes.
-        getBinIndices(i1,bin);
-        int sepIndex(bin[1]), zIndex(bin[2]);
-        // Calculate and save the value of ll - ll0 at the center of this bin.
+    // Group the bins with data by their sep,z indices, since only bins in the same group are
+    // modified, and save the value of ll - ll0 at the center of each bin.
+    typedef std::vector<std::pair<int,double> > BinGroup;
+    std::map<std::pair<int,int>,BinGroup> groups;
+    std::vector<int> bin(3);
+    for(IndexIterator iter = begin(); iter != end(); ++iter) {
+        int index(*iter);
+        getBinIndices(index,bin);
         double ll(llBins->getBinCenter(bin[0]));
-        dll.push_back(ll - ll0);
-        // Loop over unique pairs (iter1,iter2) with iter2 <= iter1 (which does not
-        // necessarily imply that i2 <= i1).
-        for(IndexIterator iter2 = begin(); iter2 <= iter1; ++iter2) {
-            int i2(*iter2);
-            // Check that this bin has the same sep,z indices
-            getBinIndices(i2,bin);
-            if(bin[1] != sepIndex || bin[2] != zIndex) continue;
-            // Calculate (ll1 - ll0)*(ll2 - ll0) using cached values.
-            double d = dll[i1]*dll[i2];
-            // Update the covariance for (i1,i2)
-            // magic constants are set by the requirement that for
-            // a certain cov, you should add something that is "large"
-            // but at the same time does not make numerical errors unbearable
-            double C(getCovariance(i1,i2));
-            C += c0 + c1*d + c2*d*d;
-            setCovariance(i1,i2,C);
+        groups[std::make_pair(bin[1],bin[2])].push_back(std::make_pair(index,ll - ll0));
+    }
+
+    // Loop over groups.
+    for(std::map<std::pair<int,int>,BinGroup>::const_iterator group = groups.begin();
+    group != groups.end(); ++group) {
+        BinGroup const &members = group->second;
+        // Loop over unique pairs of bins in this group, including each bin with itself.
+        for(int k1 = 0; k1 < members.size(); ++k1) {
+            int i1(members[k1].first);
+            double dll1(members[k1].second);
+            for(int k2 = 0; k2 <= k1; ++k2) {
+                int i2(members[k2].first);
+                // Calculate (ll1 - ll0)*(ll2 - ll0) using cached values.
+                double d = dll1*members[k2].second;
+                // Update the covariance for (i1,i2)
+                // magic constants are set by the requirement that for
+                // a certain cov, you should add something that is "large"
+                // but at the same time does not make numerical errors unbearable
+                double C(getCovariance(i1,i2));
+                C += c0 + c1*d + c2*d*d;
+                setCovariance(i1,i2,C);
+            }
         }
     }
 }
@@ -175,6 +182,33 @@ double local::QuasarCorrelationData::getRedshift(int index) const {
     return _zLast;
 }
 
+void local::QuasarCorrelationData::getBinQuadrature(int index, int order, std::vector<double> &r,
+std::vector<double> &mu, std::vector<double> &z, std::vector<double> &weight) const {
+    getBinCenters(index,_binCenter);
+    getBinWidths(index,_binWidth);
+    double ll(_binCenter[0]), dll(_binWidth[0]), sep(_binCenter[1]), dsep(_binWidth[1]), zc(_binCenter[2]);
+    std::vector<double> llNodes, llWeights, sepNodes, sepWeights;
+    getGaussLegendreRule(order,ll - dll/2,ll + dll/2,llNodes,llWeights);
+    getGaussLegendreRule(order,sep - dsep/2,sep + dsep/2,sepNodes,sepWeights);
+    r.resize(0);
+    mu.resize(0);
+    weight.resize(0);
+    // The number of pairs at angular separation sep is proportional to sep within a bin, consistent
+    // with the weighted mean separation used by transform().
+    double norm(0), rNode, muNode;
+    for(int i = 0; i < order; ++i) {
+        for(int j = 0; j < order; ++j) {
+            transform(llNodes[i],sepNodes[j],0,zc,rNode,muNode);
+            r.push_back(rNode);
+            mu.push_back(muNode);
+            weight.push_back(llWeights[i]*sepWeights[j]*sepNodes[j]);
+            norm += weight.back();
+        }
+    }
+    for(int k = 0; k < weight.size(); ++k) weight[k] /= norm;
+    z.assign(weight.size(),zc);
+}
+
 void local::QuasarCorrelationData::rescaleEigenvalues(std::vector<double> modeScales) {
     // First do the rescaling.
     BinnedData::rescaleEigenvalues(modeScales);
@@ -32,6 +32,10 @@ namespace baofit {
         virtual double getCosAngle(int index) const;
         // Returns the redshift associated with the specified global index.
 	    virtual double getRedshift(int index) const;
+        // Uses a Gauss-Legendre rule in log(lambda2/lambda1) and angular separation over the bin
+        // extent, weighted by separation, and transforms each node to co-moving coordinates.
+        virtual void getBinQuadrature(int index, int order, std::vector<double> &r,
+            std::vector<double> &mu, std::vector<double> &z, std::vector<double> &weight) const;
 	    // This implementation adds a post-processing step to BinnedData::rescaleEigenvalue, in which
 	    // covariances between different separations are forced to zero, removing the effects of
 	    // round-off errors.
@@ -0,0 +1,188 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/UniformSpline.h"
+
+#include "likely/Interpolator.h"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace local = baofit;
+
+local::UniformSpline::UniformSpline(std::vector<double> const &x, std::vector<double> const &y,
+double accuracy, bool logSpacing)
+: _logSpacing(logSpacing), _coefs(0)
+{
+    _initialize(std::vector<std::vector<double> >(1,x),std::vector<std::vector<double> >(1,y),accuracy);
+}
+
+local::UniformSpline::UniformSpline(std::vector<std::vector<double> > const &x,
+std::vector<std::vector<double> > const &y, double accuracy, bool logSpacing)
+: _logSpacing(logSpacing), _coefs(0)
+{
+    _initialize(x,y,accuracy);
+}
+
+local::UniformSpline::UniformSpline(double xmin, double xmax,
+std::vector<std::vector<double> > const &values, bool logSpacing)
+: _xmin(xmin), _xmax(xmax), _maxError(0), _nFunctions(values.size()), _logSpacing(logSpacing), _coefs(0)
+{
+    if(!(xmax > xmin) || (logSpacing && !(xmin > 0))) throw RuntimeError("UniformSpline: invalid grid range.");
+    if(0 == _nFunctions || values[0].size() < 3) {
+        throw RuntimeError("UniformSpline: need at least one table of at least 3 values.");
+    }
+    _nIntervals = values[0].size() - 1;
+    for(int j = 1; j < _nFunctions; ++j) {
+        if(values[j].size() != _nIntervals + 1) throw RuntimeError("UniformSpline: tables have different sizes.");
+    }
+    _setGrid();
+    _buffer.resize(4*_nIntervals*_nFunctions);
+    _coefs = &_buffer[0];
+    // Our splines pass through each tabulated value exactly.
+    for(int j = 0; j < _nFunctions; ++j) _buildCoefficients(values[j],j);
+}
+
+local::UniformSpline::UniformSpline(double xmin, double xmax, int nIntervals, int nFunctions,
+bool logSpacing, double maxError, double const *coefs, boost::shared_ptr<void const> owner)
+: _xmin(xmin), _xmax(xmax), _maxError(maxError), _nIntervals(nIntervals), _nFunctions(nFunctions),
+_logSpacing(logSpacing), _coefs(coefs), _owner(owner)
+{
+    if(!(xmax > xmin) || (logSpacing && !(xmin > 0)) || nIntervals < 1 || nFunctions < 1 || 0 == coefs) {
+        throw RuntimeError("UniformSpline: invalid saved spline.");
+    }
+    _setGrid();
+}
+
+local::UniformSpline::~UniformSpline() { }
+
+void local::UniformSpline::_setGrid() {
+    _umin = _logSpacing ? std::log(_xmin) : _xmin;
+    double range = (_logSpacing ? std::log(_xmax) : _xmax) - _umin;
+    _spacing = range/_nIntervals;
+    _invSpacing = _nIntervals/range;
+}
+
+double local::UniformSpline::_getGridX(double index) const {
+    double u = _umin + index*_spacing;
+    return _logSpacing ? std::exp(u) : u;
+}
+
+void local::UniformSpline::_initialize(std::vector<std::vector<double> > const &x,
+std::vector<std::vector<double> > const &y, double accuracy) {
+    _nFunctions = x.size();
+    if(0 == _nFunctions || y.size() != _nFunctions) {
+        throw RuntimeError("UniformSpline: need the same number (>0) of x and y tables.");
+    }
+    if(accuracy <= 0) throw RuntimeError("UniformSpline: accuracy must be > 0.");
+    // Check the input ordering, find the scale of each table, and find the common range.
+    std::vector<double> scale(_nFunctions);
+    int nTableMax(0);
+    for(int j = 0; j < _nFunctions; ++j) {
+        std::vector<double> const &xj = x[j], &yj = y[j];
+        int nTable(xj.size());
+        if(nTable < 3 || yj.size() != nTable) {
+            throw RuntimeError("UniformSpline: need at least 3 tabulated (x,y) points.");
+        }
+        scale[j] = std::fabs(yj[0]);
+        if(_logSpacing && !(xj[0] > 0)) {
+            throw RuntimeError("UniformSpline: x values must be positive with log spacing.");
+        }
+        for(int i = 1; i < nTable; ++i) {
+            if(!(xj[i] > xj[i-1])) throw RuntimeError("UniformSpline: x values must be increasing.");
+            if(std::fabs(yj[i]) > scale[j]) scale[j] = std::fabs(yj[i]);
+        }
+        if(0 == scale[j]) scale[j] = 1;
+        if(0 == j || xj.front() > _xmin) _xmin = xj.front();
+        if(0 == j || xj.back() < _xmax) _xmax = xj.back();
+        if(nTable > nTableMax) nTableMax = nTable;
+    }
+    if(!(_xmax > _xmin)) throw RuntimeError("UniformSpline: tables do not overlap.");
+    // The natural cubic spline through the input points of each table is our reference.
+    std::vector<likely::InterpolatorPtr> exact;
+    for(int j = 0; j < _nFunctions; ++j) {
+        exact.push_back(likely::InterpolatorPtr(new likely::Interpolator(x[j],y[j],"cspline")));
+    }
+    // Start from the average input spacing, which reproduces the reference exactly when the
+    // input points are already uniformly spaced, and halve the spacing until we are accurate enough.
+    int const maxIntervals(1 << 20);
+    _nIntervals = nTableMax - 1;
+    std::vector<double> values;
+    while(true) {
+        _setGrid();
+        _buffer.resize(4*_nIntervals*_nFunctions);
+        _coefs = &_buffer[0];
+        values.resize(_nIntervals+1);
+        _maxError = 0;
+        for(int j = 0; j < _nFunctions; ++j) {
+            likely::Interpolator const &reference = *exact[j];
+            values[0] = reference(_xmin);
+            for(int i = 1; i < _nIntervals; ++i) values[i] = reference(_getGridX(i));
+            values[_nIntervals] = reference(_xmax);
+            _buildCoefficients(values,j);
+            // Compare with the reference at the input points and within each grid interval.
+            double maxError(0);
+            for(int i = 0; i < x[j].size(); ++i) {
+                if(x[j][i] < _xmin || x[j][i] > _xmax) continue;
+                double error = std::fabs((*this)(x[j][i],j) - y[j][i]);
+                if(error > maxError) maxError = error;
+            }
+            for(int i = 0; i < _nIntervals; ++i) {
+                for(int k = 1; k <= 3; ++k) {
+                    double xk = _getGridX(i + 0.25*k);
+                    double error = std::fabs((*this)(xk,j) - reference(xk));
+                    if(error > maxError) maxError = error;
+                }
+            }
+            maxError /= scale[j];
+            if(maxError > _maxError) _maxError = maxError;
+        }
+        if(_maxError <= accuracy) break;
+        if(2*_nIntervals > maxIntervals) {
+            throw RuntimeError("UniformSpline: unable to achieve the requested accuracy.");
+        }
+        _nIntervals *= 2;
+    }
+}
+
+void local::UniformSpline::_buildCoefficients(std::vector<double> const &values, int function) {
+    // Solve the tridiagonal system m[i-1] + 4m[i] + m[i+1] = 6(y[i-1] - 2y[i] + y[i+1]) for the
+    // second derivatives m[i] with respect to u, with m[0] = m[n] = 0 for a natural spline.
+    int n(_nIntervals);
+    std::vector<double> m(n+1,0), work(n+1,0);
+    for(int i = 1; i < n; ++i) {
+        double rhs = 6*(values[i-1] - 2*values[i] + values[i+1]);
+        double pivot = 4 - work[i-1];
+        work[i] = 1/pivot;
+        m[i] = (rhs - m[i-1])/pivot;
+    }
+    for(int i = n-2; i > 0; --i) m[i] -= work[i]*m[i+1];
+    int stride(_nFunctions);
+    for(int i = 0; i < n; ++i) {
+        double *c = &_buffer[4*i*stride + function];
+        c[0] = values[i];
+        c[stride] = (values[i+1] - values[i]) - (2*m[i] + m[i+1])/6;
+        c[2*stride] = m[i]/2;
+        c[3*stride] = (m[i+1] - m[i])/6;
+    }
+}
+
+void local::UniformSpline::readTable(std::string const &filename,
+std::vector<double> &x, std::vector<double> &y) {
+    std::ifstream in(filename.c_str());
+    if(!in.good()) throw RuntimeError("UniformSpline: unable to open " + filename);
+    x.clear();
+    y.clear();
+    std::string line;
+    while(std::getline(in,line)) {
+        std::size_t first = line.find_first_not_of(" \t\r");
+        if(first == std::string::npos || line[first] == '#') continue;
+        std::istringstream fields(line);
+        double xval, yval;
+        if(!(fields >> xval >> yval)) {
+            throw RuntimeError("UniformSpline: badly formatted line in " + filename);
+        }
+        x.push_back(xval);
+        y.push_back(yval);
+    }
+}
@@ -0,0 +1,125 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#ifndef BAOFIT_UNIFORM_SPLINE
+#define BAOFIT_UNIFORM_SPLINE
+
+#include "baofit/RuntimeError.h"
+
+#include "boost/smart_ptr.hpp"
+
+#include <string>
+#include <vector>
+#include <cmath>
+
+namespace baofit {
+    // Represents one or more cubic splines tabulated on a shared uniform grid with precomputed
+    // polynomial coefficients for each interval, so that each lookup is an index calculation followed
+    // by a cubic polynomial, with no search. The grid is chosen to reproduce the natural cubic spline
+    // through an arbitrary set of tabulated points to a specified accuracy. The coefficients of all
+    // functions for one interval are stored contiguously, so that evaluating every function at the
+    // same x touches a single block of memory. The grid can optionally be uniform in log(x) instead
+    // of x, which is more efficient for tables that span several decades.
+	class UniformSpline {
+	public:
+        // Creates a new spline that matches the natural cubic spline through the points (x[i],y[i])
+        // to within accuracy*max|y[i]|, using the first grid that achieves this when successively
+        // halving the spacing, starting from the average spacing of the input x values, which must
+        // be increasing (and positive if logSpacing is true).
+		UniformSpline(std::vector<double> const &x, std::vector<double> const &y, double accuracy,
+            bool logSpacing = false);
+        // Creates a new set of splines on a shared grid for the tables (x[j],y[j]) with the same
+        // accuracy criterion applied to each table, covering the range common to all tables.
+		UniformSpline(std::vector<std::vector<double> > const &x,
+            std::vector<std::vector<double> > const &y, double accuracy, bool logSpacing = false);
+        // Creates a new set of natural cubic splines through values[j][i] tabulated directly on
+        // a uniform grid of n >= 3 points covering [xmin,xmax], where n is the same for each table.
+        // Use this when the values are already available on such a grid, to avoid resampling.
+		UniformSpline(double xmin, double xmax, std::vector<std::vector<double> > const &values,
+            bool logSpacing = false);
+		virtual ~UniformSpline();
+        // Returns the interpolated value of the specified function at x. Values of x outside our
+        // tabulated range are clamped to it, without any error, so callers should check their
+        // range once against getXMin() and getXMax() rather than for each lookup.
+        double operator()(double x, int function = 0) const;
+        // Fills values[0..nFunctions-1] with the interpolated value of each function at x, which
+        // is clamped to our tabulated range as above.
+        void evaluate(double x, double *values) const;
+        // Returns the range of x values covered by this spline.
+        double getXMin() const;
+        double getXMax() const;
+        // Returns the number of functions represented by this spline.
+        int getNFunctions() const;
+        // Returns the number of uniform grid points used by this spline.
+        int getNPoints() const;
+        // Returns the largest difference from the natural cubic spline found while building this
+        // spline, relative to max|y[i]| and maximized over functions.
+        double getMaxError() const;
+        // Reads whitespace-separated (x,y) values from the first two columns of the named file,
+        // ignoring empty lines and lines that start with '#'.
+        static void readTable(std::string const &filename, std::vector<double> &x, std::vector<double> &y);
+	private:
+        // ModelPack saves our coefficients and creates views of previously saved coefficients.
+        friend class ModelPack;
+        // Creates a view of coefficients that are owned by someone else, typically a memory-mapped
+        // file, which will be kept alive by holding a reference to the owner provided.
+        UniformSpline(double xmin, double xmax, int nIntervals, int nFunctions, bool logSpacing,
+            double maxError, double const *coefs, boost::shared_ptr<void const> owner);
+        // Splines are not copyable since their coefficients can be stored in their own buffer.
+        UniformSpline(UniformSpline const &other);
+        UniformSpline &operator=(UniformSpline const &other);
+        void _initialize(std::vector<std::vector<double> > const &x,
+            std::vector<std::vector<double> > const &y, double accuracy);
+        // Sets our grid spacing and the location of our grid origin.
+        void _setGrid();
+        // Returns the x value at the specified (fractional) grid index.
+        double _getGridX(double index) const;
+        // Calculates the coefficients of the natural cubic spline through the specified values
+        // on our uniform grid for one function.
+        void _buildCoefficients(std::vector<double> const &values, int function);
+        // Returns a pointer to the coefficients of the interval containing x and sets u to the
+        // fractional offset of x within this interval.
+        double const *_locate(double x, double &u) const;
+        double _xmin, _xmax, _umin, _spacing, _invSpacing, _maxError;
+        int _nIntervals, _nFunctions;
+        bool _logSpacing;
+        // Coefficients of the cubic polynomial in the fractional offset u = (x-x[i])/spacing
+        // for interval i and function j are stored in _coefs[(4*i+k)*nFunctions+j] for k = 0,1,2,3,
+        // where x is replaced by log(x) with log spacing. The coefficients are either stored in
+        // our own buffer or else owned by someone else.
+        std::vector<double> _buffer;
+        double const *_coefs;
+        boost::shared_ptr<void const> _owner;
+	}; // UniformSpline
+
+    inline double const *UniformSpline::_locate(double x, double &u) const {
+        // Clamp x to our range, which also catches NaN values.
+        if(!(x > _xmin)) x = _xmin;
+        else if(x > _xmax) x = _xmax;
+        double t = ((_logSpacing ? std::log(x) : x) - _umin)*_invSpacing;
+        int index = (int)t;
+        if(index >= _nIntervals) index = _nIntervals - 1;
+        u = t - index;
+        return _coefs + 4*index*_nFunctions;
+    }
+    inline double UniformSpline::operator()(double x, int function) const {
+        double u;
+        double const *c = _locate(x,u) + function;
+        int n(_nFunctions);
+        return c[0] + u*(c[n] + u*(c[2*n] + u*c[3*n]));
+    }
+    inline void UniformSpline::evaluate(double x, double *values) const {
+        double u;
+        double const *c0 = _locate(x,u);
+        double const *c1 = c0 + _nFunctions, *c2 = c1 + _nFunctions, *c3 = c2 + _nFunctions;
+        // Each coefficient is contiguous across functions, so this loop vectorizes.
+        for(int j = 0; j < _nFunctions; ++j) values[j] = c0[j] + u*(c1[j] + u*(c2[j] + u*c3[j]));
+    }
+    inline double UniformSpline::getXMin() const { return _xmin; }
+    inline double UniformSpline::getXMax() const { return _xmax; }
+    inline int UniformSpline::getNFunctions() const { return _nFunctions; }
+    inline int UniformSpline::getNPoints() const { return _nIntervals + 1; }
+    inline double UniformSpline::getMaxError() const { return _maxError; }
+
+} // baofit
+
+#endif // BAOFIT_UNIFORM_SPLINE
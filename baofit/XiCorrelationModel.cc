@@ -2,8 +2,8 @@
 
 #include "baofit/XiCorrelationModel.h"
 #include "baofit/RuntimeError.h"
-
-#include "likely/Interpolator.h"
+#include "baofit/EvaluationContext.h"
+#include "baofit/FitProfile.h"
 
 #include "boost/format.hpp"
 #include "boost/spirit/include/qi.hpp"
@@ -12,6 +12,7 @@
 #include "boost/spirit/include/phoenix_stl.hpp"
 
 #include <cmath>
+#include <algorithm>
 
 namespace local = baofit;
 namespace qi = boost::spirit::qi;
@@ -37,6 +38,44 @@ local::XiCorrelationModel::XiCorrelationModel(std::string const &points, double
     if(!ok || iter != points.end()) {
         throw RuntimeError("XiCorrelationModel: badly formatted points list.");
     }
+    int npoints(_rValues.size());
+    for(int j = 1; j < npoints; ++j) {
+        if(!(_rValues[j] > _rValues[j-1])) throw RuntimeError("XiCorrelationModel: points must be increasing.");
+    }
+    if(method == "linear") {
+        if(npoints < 2) throw RuntimeError("XiCorrelationModel: linear interpolation needs at least 2 points.");
+        _nWeights = 2;
+    }
+    else if(method == "cspline") {
+        if(npoints < 3) throw RuntimeError("XiCorrelationModel: cspline interpolation needs at least 3 points.");
+        _nWeights = npoints;
+        // Tabulate the second derivatives of the natural cubic spline at each point as linear
+        // combinations of the interpolated values, by solving the spline's tridiagonal system
+        // h[j-1] M[j-1] + 2(h[j-1]+h[j]) M[j] + h[j] M[j+1] = 6(dy[j]/h[j] - dy[j-1]/h[j-1])
+        // with M[0] = M[npoints-1] = 0 for each unit vector of values.
+        _curvature.resize(npoints*npoints,0);
+        std::vector<double> unit(npoints,0), slope(npoints-1), super(npoints), rhs(npoints);
+        for(int k = 0; k < npoints; ++k) {
+            unit[k] = 1;
+            for(int j = 0; j < npoints-1; ++j) {
+                slope[j] = (unit[j+1] - unit[j])/(_rValues[j+1] - _rValues[j]);
+            }
+            // Forward elimination, then back substitution.
+            for(int j = 1; j < npoints-1; ++j) {
+                double hlo(_rValues[j] - _rValues[j-1]), hhi(_rValues[j+1] - _rValues[j]);
+                double pivot = 2*(hlo + hhi) - (j > 1 ? hlo*super[j-1] : 0);
+                super[j] = hhi/pivot;
+                rhs[j] = (6*(slope[j] - slope[j-1]) - (j > 1 ? hlo*rhs[j-1] : 0))/pivot;
+            }
+            for(int j = npoints-2; j > 0; --j) {
+                _curvature[j*npoints + k] = rhs[j] - (j < npoints-2 ? super[j]*_curvature[(j+1)*npoints + k] : 0);
+            }
+            unit[k] = 0;
+        }
+    }
+    else {
+        throw RuntimeError("XiCorrelationModel: expected method to be linear or cspline.");
+    }
 
     // Linear bias parameters
     _indexBase = 1 + _defineLinearBiasParameters(zref);
@@ -49,78 +88,168 @@ local::XiCorrelationModel::XiCorrelationModel(std::string const &points, double
         else if(4 == ell) perr = 0.01;
         for(int index = 0; index < _rValues.size(); ++index) {
             double rval(_rValues[index]);
-            defineParameter(boost::str(pname % ell % index),0,perr);
+            int pindex = defineParameter(boost::str(pname % ell % index),0,perr);
+            _declareLinearParameter(pindex);
         }
     }
+    _xiValues.resize(3*npoints);
 }
 
 local::XiCorrelationModel::~XiCorrelationModel() { }
 
-void local::XiCorrelationModel::_initializeInterpolators() const {
-    int index, npoints(_rValues.size());
-    // Do we need to (re)initialize our xi0 interpolator?
-    for(index = 0; index < npoints; ++index) {
-        if(isParameterValueChanged(_indexBase + index)) break;
-    }
-    if(index < npoints) {
-        _xiValues.resize(0);
-        for(index = 0; index < npoints; ++index) {
-            _xiValues.push_back(getParameterValue(_indexBase + index));
-        }
-        _xi0.reset(new likely::Interpolator(_rValues,_xiValues,_method));
+void local::XiCorrelationModel::_prepareEvaluation(bool anyChanged) {
+    // Copying all of the values is cheaper than checking which of them have changed.
+    for(int index = 0; index < _xiValues.size(); ++index) {
+        _xiValues[index] = getParameterValue(_indexBase + index);
     }
-    // Do we need to (re)initialize our xi2 interpolator?
-    for(index = npoints; index < 2*npoints; ++index) {
-        if(isParameterValueChanged(_indexBase + index)) break;
-    }
-    if(index < 2*npoints) {
-        _xiValues.resize(0);
-        for(index = npoints; index < 2*npoints; ++index) {
-            _xiValues.push_back(getParameterValue(_indexBase + index));
-        }
-        _xi2.reset(new likely::Interpolator(_rValues,_xiValues,_method));
-    }
-    // Do we need to (re)initialize our xi4 interpolator?
-    for(index = 2*npoints; index < 3*npoints; ++index) {
-        if(isParameterValueChanged(_indexBase + index)) break;
+}
+
+void local::XiCorrelationModel::_bindRange(int n, double const *r, double const *mu, double const *z,
+EvaluationContext &context) const {
+    _bindWeights(n,r,context);
+}
+
+void local::XiCorrelationModel::_bindRange(int n, double const *r, cosmo::Multipole const *multipole,
+double const *z, EvaluationContext &context) const {
+    _bindWeights(n,r,context);
+}
+
+void local::XiCorrelationModel::_bindWeights(int n, double const *r, EvaluationContext &context) const {
+    FitProfile *profile = context.getProfile();
+    double start(profile ? FitProfile::getWallTime() : 0);
+    int npoints(_rValues.size());
+    // Tabulate the weight of each point in each bin's interpolated value.
+    std::vector<double> dense(n*npoints);
+    for(int i = 0; i < n; ++i) _getWeights(r[i],&dense[i*npoints]);
+    // Only keep the band of _nWeights points starting with each bin's first non-zero weight.
+    std::vector<double> &weights = context.getBuffer(this,WEIGHTS);
+    std::vector<double> &first = context.getBuffer(this,FIRST);
+    weights.resize(n*_nWeights);
+    first.resize(n);
+    for(int i = 0; i < n; ++i) {
+        double const *row = &dense[i*npoints];
+        int j0(0);
+        while(j0 < npoints - _nWeights && 0 == row[j0]) ++j0;
+        first[i] = j0;
+        for(int k = 0; k < _nWeights; ++k) weights[i*_nWeights + k] = row[j0 + k];
     }
-    if(index < 3*npoints) {
-        _xiValues.resize(0);
-        for(index = 2*npoints; index < 3*npoints; ++index) {
-            _xiValues.push_back(getParameterValue(_indexBase + index));
-        }
-        _xi4.reset(new likely::Interpolator(_rValues,_xiValues,_method));
+    if(profile) profile->addTerm("xi-weights",false,FitProfile::getWallTime() - start);
+}
+
+void local::XiCorrelationModel::_getWeights(double r, double *row) const {
+    int npoints(_rValues.size());
+    if(!(r >= _rValues[0] && r <= _rValues[npoints-1])) {
+        throw RuntimeError("XiCorrelationModel: r is outside the interpolation range.");
     }
+    // Find the interval [_rValues[j],_rValues[j+1]] containing r.
+    int j = std::upper_bound(_rValues.begin(),_rValues.end(),r) - _rValues.begin() - 1;
+    if(j > npoints-2) j = npoints-2;
+    double h(_rValues[j+1] - _rValues[j]), t((r - _rValues[j])/h);
+    std::fill(row,row + npoints,0.);
+    row[j] = 1 - t;
+    row[j+1] = t;
+    if(_curvature.empty()) return;
+    // Add the natural cubic spline terms h^2/6 ((1-t)^3 - (1-t)) M[j] + h^2/6 (t^3 - t) M[j+1].
+    double clo(h*h/6*((1-t)*(1-t)*(1-t) - (1-t))), chi(h*h/6*(t*t*t - t));
+    double const *Mlo = &_curvature[j*npoints], *Mhi = Mlo + npoints;
+    for(int k = 0; k < npoints; ++k) row[k] += clo*Mlo[k] + chi*Mhi[k];
 }
 
 double local::XiCorrelationModel::_evaluate(double r, double mu, double z, bool anyChanged) const {
-    // Rebuild our interpolators, if necessary.
-    if(anyChanged) _initializeInterpolators();
-    // Calculate the Legendre weights.
-    double muSq(mu*mu);
-    double L0(1), L2 = (3*muSq - 1)/2., L4 = (35*muSq*muSq - 30*muSq + 3)/8.;
-    // Put the pieces together.
-    return (
-        _getNormFactor(cosmo::Monopole,z)*L0*(*_xi0)(r) +
-        _getNormFactor(cosmo::Quadrupole,z)*L2*(*_xi2)(r) +
-        _getNormFactor(cosmo::Hexadecapole,z)*L4*(*_xi4)(r)
-        )/(r*r);
+    double result;
+    bindRange(1,&r,&mu,&z,_getDefaultContext());
+    _evaluateBatch(1,&r,&mu,&z,&result,_getDefaultContext());
+    return result;
 }
 
 double local::XiCorrelationModel::_evaluate(double r, cosmo::Multipole multipole, double z,
 bool anyChanged) const {
-    // Rebuild our interpolators, if necessary.
-    if(anyChanged) _initializeInterpolators();
-    // Return the appropriately normalized multipole.
-    switch(multipole) {
-    case cosmo::Monopole:
-        return _getNormFactor(cosmo::Monopole,z)*(*_xi0)(r)/(r*r);
-    case cosmo::Quadrupole:
-        return _getNormFactor(cosmo::Quadrupole,z)*(*_xi2)(r)/(r*r);
-    case cosmo::Hexadecapole:
-        return _getNormFactor(cosmo::Hexadecapole,z)*(*_xi4)(r)/(r*r);
+    double result;
+    bindRange(1,&r,&multipole,&z,_getDefaultContext());
+    _evaluateBatch(1,&r,&multipole,&z,&result,_getDefaultContext());
+    return result;
+}
+
+void local::XiCorrelationModel::_evaluateBatch(int n, double const *r, double const *mu, double const *z,
+double *result, EvaluationContext &context) const {
+    if(n <= 0) return;
+    FitProfile *profile = context.getProfile();
+    double start(profile ? FitProfile::getWallTime() : 0);
+    double const *weights = &context.getBuffer(this,WEIGHTS)[0];
+    double const *first = &context.getBuffer(this,FIRST)[0];
+    double const *L2 = _getLegendreWeights(context), *L4 = L2 + n;
+    int npoints(_rValues.size());
+    for(int i = 0; i < n; ++i) {
+        // Interpolate each multipole using this bin's weights.
+        double const *w = weights + i*_nWeights;
+        double const *y0 = &_xiValues[(int)first[i]], *y2 = y0 + npoints, *y4 = y2 + npoints;
+        double xi0(0), xi2(0), xi4(0);
+        for(int k = 0; k < _nWeights; ++k) {
+            xi0 += w[k]*y0[k];
+            xi2 += w[k]*y2[k];
+            xi4 += w[k]*y4[k];
+        }
+        // Put the pieces together.
+        double const *norm = _getRedshiftFactors(z[i],context);
+        result[i] = (norm[NORM0]*xi0 + norm[NORM2]*L2[i]*xi2 + norm[NORM4]*L4[i]*xi4)/(r[i]*r[i]);
+    }
+    if(profile) profile->addTerm("xi-multipoles",false,FitProfile::getWallTime() - start);
+}
+
+void local::XiCorrelationModel::_evaluateBatch(int n, double const *r, cosmo::Multipole const *multipole,
+double const *z, double *result, EvaluationContext &context) const {
+    if(n <= 0) return;
+    FitProfile *profile = context.getProfile();
+    double start(profile ? FitProfile::getWallTime() : 0);
+    double const *weights = &context.getBuffer(this,WEIGHTS)[0];
+    double const *first = &context.getBuffer(this,FIRST)[0];
+    int npoints(_rValues.size());
+    for(int i = 0; i < n; ++i) {
+        // Return the appropriately normalized multipole.
+        double const *norm = _getRedshiftFactors(z[i],context);
+        int block;
+        switch(multipole[i]) {
+        case cosmo::Monopole:
+            block = 0;
+            break;
+        case cosmo::Quadrupole:
+            block = 1;
+            break;
+        case cosmo::Hexadecapole:
+            block = 2;
+            break;
+        default:
+            throw RuntimeError("XiCorrelationModel: invalid multipole.");
+        }
+        double const *w = weights + i*_nWeights;
+        double const *y = &_xiValues[block*npoints + (int)first[i]];
+        double xi(0);
+        for(int k = 0; k < _nWeights; ++k) xi += w[k]*y[k];
+        result[i] = norm[NORM0 + block]*xi/(r[i]*r[i]);
+    }
+    if(profile) profile->addTerm("xi-multipoles",false,FitProfile::getWallTime() - start);
+}
+
+void local::XiCorrelationModel::_evaluateLinearBasis(int n, double const *r, double const *mu,
+double const *z, double *basis, int stride, EvaluationContext &context) const {
+    if(n <= 0) return;
+    double const *weights = &context.getBuffer(this,WEIGHTS)[0];
+    double const *first = &context.getBuffer(this,FIRST)[0];
+    double const *L2 = _getLegendreWeights(context), *L4 = L2 + n;
+    int npoints(_rValues.size());
+    for(int column = 0; column < 3*npoints; ++column) {
+        std::fill(basis + column*stride,basis + column*stride + n,0.);
+    }
+    for(int i = 0; i < n; ++i) {
+        double const *w = weights + i*_nWeights;
+        double const *norm = _getRedshiftFactors(z[i],context);
+        double rsq(r[i]*r[i]);
+        double scale[3] = { norm[NORM0]/rsq, norm[NORM2]*L2[i]/rsq, norm[NORM4]*L4[i]/rsq };
+        for(int block = 0; block < 3; ++block) {
+            double *column = basis + (block*npoints + (int)first[i])*stride + i;
+            for(int k = 0; k < _nWeights; ++k) column[k*stride] = scale[block]*w[k];
+        }
     }
-    throw RuntimeError("XiCorrelationModel: invalid multipole.");
 }
 
 void  local::XiCorrelationModel::printToStream(std::ostream &out, std::string const &formatSpec) const {
@@ -12,9 +12,13 @@
 
 namespace baofit {
 	// Represents a two-point correlation model parameterized as an interpolation in each multipole.
+	// Since linear and cubic spline interpolation are both linear in the interpolated values, each
+	// bin's prediction is a fixed weighted sum of the values, and the values are declared as linear
+	// parameters.
 	class XiCorrelationModel : public AbsCorrelationModel {
 	public:
-	    // Creates a new interpolating correlation model.
+	    // Creates a new interpolating correlation model using the specified comma-separated list of
+	    // interpolation points in Mpc/h and method, which must be either linear or cspline.
 		XiCorrelationModel(std::string const &points, double zref, std::string const &method = "linear");
 		virtual ~XiCorrelationModel();
         // Prints a multi-line description of this object to the specified output stream.
@@ -27,13 +31,35 @@ namespace baofit {
         // Returns the correlation function for the specified multipole at co-moving pair separation
         // r and average pair redshift z.
         virtual double _evaluate(double r, cosmo::Multipole multipole, double z, bool anyChanged) const;
+        // Loads the interpolation values from the current parameter values.
+        virtual void _prepareEvaluation(bool anyChanged);
+        // Tabulates the interpolation weights of each bin, which only depend on r.
+        virtual void _bindRange(int n, double const *r, double const *mu, double const *z,
+            EvaluationContext &context) const;
+        virtual void _bindRange(int n, double const *r, cosmo::Multipole const *multipole,
+            double const *z, EvaluationContext &context) const;
+        // Batch versions of the methods above that fill result[0..n-1].
+        virtual void _evaluateBatch(int n, double const *r, double const *mu, double const *z,
+            double *result, EvaluationContext &context) const;
+        virtual void _evaluateBatch(int n, double const *r, cosmo::Multipole const *multipole,
+            double const *z, double *result, EvaluationContext &context) const;
+        // Fills the derivatives with respect to each interpolation value, in the order ell=0,2,4.
+        virtual void _evaluateLinearBasis(int n, double const *r, double const *mu, double const *z,
+            double *basis, int stride, EvaluationContext &context) const;
 	private:
         std::string _method;
         int _indexBase;
-        std::vector<double> _rValues;
-        mutable std::vector<double> _xiValues;
-        mutable likely::InterpolatorPtr _xi0, _xi2, _xi4;
-        void _initializeInterpolators() const;
+        std::vector<double> _rValues, _xiValues;
+        // Each bin's weights are non-zero for at most _nWeights consecutive points, so that
+        // xi_ell(r[i]) = Sum[WEIGHTS[i*_nWeights+k] y_ell[FIRST[i]+k], {k,0,_nWeights-1}].
+        int _nWeights;
+        enum { WEIGHTS = 0, FIRST = 1 };
+        void _bindWeights(int n, double const *r, EvaluationContext &context) const;
+        // With cspline interpolation, the spline's second derivative at point j is
+        // Sum[_curvature[j*npoints+k] y[k], {k,0,npoints-1}]. Empty for linear interpolation.
+        std::vector<double> _curvature;
+        // Fills row[0..npoints-1] with the weight of each point in the interpolated value at r.
+        void _getWeights(double r, double *row) const;
 	}; // XiCorrelationModel
 } // baofit
 
@@ -4,6 +4,7 @@
 
 #include "baofit/RuntimeError.h"
 
+#include "baofit/EvaluationContext.h"
 #include "baofit/AbsCorrelationModel.h"
 #include "baofit/BaoCorrelationModel.h"
 #include "baofit/BroadbandModel.h"
@@ -17,3 +18,10 @@
 
 #include "baofit/CorrelationFitter.h"
 #include "baofit/CorrelationAnalyzer.h"
+#include "baofit/FitProfile.h"
+#include "baofit/UniformSpline.h"
+#include "baofit/ModelPack.h"
+#include "baofit/quadrature.h"
+#include "baofit/FFTLog.h"
+#include "baofit/PeakBroadening.h"
+#include "baofit/sineIntegral.h"
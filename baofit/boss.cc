@@ -358,7 +358,7 @@ baofit::AbsCorrelationDataCPtr prototype, bool verbose) {
                 int index1 = *iter++, index2 = *iter++;
                 double cinv = *((double*)iter);
                 iter += 2;
-                binnedData->setInverseCovariance(index1, index2, cinv);
+                binnedData->setSparseInverseCovariance(index1, index2, cinv);
             }
         }
         else {
@@ -471,7 +471,7 @@ baofit::AbsCorrelationDataCPtr prototype, bool verbose) {
                 boost::lexical_cast<std::string>(lines) + " of " + paramsName);
         }
         // Add this covariance to our dataset.
-        binnedData->setInverseCovariance(index1,index2,value);
+        binnedData->setSparseInverseCovariance(index1,index2,value);
     }
     covIn.close();
     if(verbose) {
@@ -598,7 +598,7 @@ int &reuseCovIndex, int reuseCov) {
             if(icov) value = -value; // !?! see line #388 of Observed2Point.cpp
             int index1 = *(binnedData->begin()+offset1), index2 = *(binnedData->begin()+offset2);
             if(icov) {
-                binnedData->setInverseCovariance(index1,index2,value);
+                binnedData->setSparseInverseCovariance(index1,index2,value);
             }
             else {
                 binnedData->setCovariance(index1,index2,value);
@@ -617,7 +617,7 @@ int &reuseCovIndex, int reuseCov) {
             int index = *iter;
             if(icov) {
                 if(0 == binnedData->getInverseCovariance(index,index)) {
-                    binnedData->setInverseCovariance(index,index,1e-30);
+                    binnedData->setSparseInverseCovariance(index,index,1e-30);
                 }
             }
             else {
@@ -743,7 +743,7 @@ AbsCorrelationDataCPtr prototype, bool verbose, bool weighted, int reuseCov) {
         // Add this covariance to our dataset.
         value = -value; // !?! see line #388 of Observed2Point.cpp
         int index1 = *(binnedData->begin()+offset1), index2 = *(binnedData->begin()+offset2);
-        binnedData->setInverseCovariance(index1,index2,value);
+        binnedData->setSparseInverseCovariance(index1,index2,value);
     }
     covIn.close();
     if(false) {
@@ -757,7 +757,7 @@ AbsCorrelationDataCPtr prototype, bool verbose, bool weighted, int reuseCov) {
     iter != binnedData->end(); ++iter) {
         int index = *iter;
         if(0 == binnedData->getInverseCovariance(index,index)) {
-            binnedData->setInverseCovariance(index,index,1e-30);
+            binnedData->setSparseInverseCovariance(index,index,1e-30);
         }
     }
 
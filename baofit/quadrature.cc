@@ -0,0 +1,49 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/quadrature.h"
+#include "baofit/RuntimeError.h"
+
+#include <cmath>
+
+namespace local = baofit;
+
+void local::getGaussLegendreRule(int n, double xmin, double xmax, std::vector<double> &x,
+std::vector<double> &w) {
+    if(n < 1) throw RuntimeError("getGaussLegendreRule: expected n >= 1.");
+    if(xmax <= xmin) throw RuntimeError("getGaussLegendreRule: expected xmin < xmax.");
+    x.resize(n);
+    w.resize(n);
+    int const maxIterations(100);
+    double pi(4*std::atan(1)), mid(0.5*(xmax + xmin)), half(0.5*(xmax - xmin));
+    for(int i = 0; i < n; ++i) {
+        // Refine the standard initial guess for the i-th root of P_n with Newton's method.
+        double root = std::cos(pi*(i+0.75)/(n+0.5)), deriv;
+        bool converged(false);
+        for(int iter = 0; iter < maxIterations; ++iter) {
+            // Calculate P_n(root) and its derivative using the Legendre recursion.
+            double p0(1), p1(0);
+            for(int ell = 0; ell < n; ++ell) {
+                double pm = p1;
+                p1 = p0;
+                p0 = ((2*ell+1)*root*p1 - ell*pm)/(ell+1);
+            }
+            deriv = n*(root*p0 - p1)/(root*root - 1);
+            double last(root);
+            root = last - p0/deriv;
+            if(std::fabs(root - last) < 1e-15) {
+                converged = true;
+                break;
+            }
+        }
+        if(!converged) throw RuntimeError("getGaussLegendreRule: root finding did not converge.");
+        // Roots are found in decreasing order, so fill from the end to return increasing x.
+        x[n-1-i] = mid + half*root;
+        w[n-1-i] = half*2/((1 - root*root)*deriv*deriv);
+    }
+    // The weights should sum to the interval length, since constants are integrated exactly.
+    double sum(0);
+    for(int i = 0; i < n; ++i) sum += w[i];
+    if(!(std::fabs(sum - (xmax - xmin)) <= 1e-12*(xmax - xmin))) {
+        throw RuntimeError("getGaussLegendreRule: weights do not sum to the interval length.");
+    }
+}
@@ -0,0 +1,16 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#ifndef BAOFIT_QUADRATURE
+#define BAOFIT_QUADRATURE
+
+#include <vector>
+
+namespace baofit {
+    // Fills x and w with the nodes and weights of the n-point Gauss-Legendre rule on [xmin,xmax],
+    // which integrates polynomials of degree up to 2n-1 exactly. Throws a RuntimeError if the
+    // roots cannot be found to double precision.
+    void getGaussLegendreRule(int n, double xmin, double xmax, std::vector<double> &x,
+        std::vector<double> &w);
+} // baofit
+
+#endif // BAOFIT_QUADRATURE
@@ -0,0 +1,132 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/sineIntegral.h"
+
+#include "gsl/gsl_sf_expint.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace local = baofit;
+
+namespace baofit {
+namespace si {
+    // We use the power series of Si(x)/x below xSplit and its asymptotic form
+    //
+    //   Si(x) = pi/2 - f(x) cos(x) - g(x) sin(x)
+    //
+    // above, where f(x) ~ 1/x and g(x) ~ 1/x^2 are the auxiliary functions of Abramowitz
+    // and Stegun 5.2.6-7.
+    double const xSplit = 12;
+    // Chebyshev coefficients of S(u) = Si(x)/x as a function of u = x^2 on [0,xSplit^2].
+    int const nS = 19;
+    double const cS[nS] = {
+         3.12862701231868570e-01,-2.93202304376969992e-01, 1.79215697796988172e-01,
+        -1.18934798944294686e-01, 6.42710727529009282e-02,-2.39817711018394740e-02,
+         6.19335436063107791e-03,-1.15598546365126781e-03, 1.62722137254872105e-04,
+        -1.78900858682053174e-05, 1.57981172852514844e-06,-1.14604451110855311e-07,
+         6.95628876100906071e-09,-3.58711311332750651e-10, 1.59171385991888244e-11,
+        -6.14437020617845768e-13, 2.08291076850579057e-14,-6.25256004740601390e-16,
+         1.68898369682507488e-17
+    };
+    // Chebyshev coefficients of x f(x) and x^2 g(x) as functions of s = (xSplit/x)^2 on [0,1].
+    int const nF = 17;
+    double const cF[nF] = {
+         9.93431491799952627e-01,-6.45153691297634597e-03, 1.12418908164224226e-04,
+        -4.26660159490649086e-06, 2.60894586714351974e-07,-2.21295943347962938e-08,
+         2.38697784941380078e-09,-3.09780755167277729e-10, 4.65899143317448491e-11,
+        -7.90623455918480766e-12, 1.48433390450045891e-12,-3.03716424636412720e-13,
+         6.69428908465184713e-14,-1.57465762705508855e-14, 3.92312457476659548e-15,
+        -1.02904169289440989e-15, 2.82715880870962333e-16
+    };
+    int const nG = 17;
+    double const cG[nG] = {
+         9.80954384792055858e-01,-1.85026771028171920e-02, 5.14676911619174237e-04,
+        -2.60846212274091797e-05, 1.95532782994056803e-06,-1.93557101478687395e-07,
+         2.36116798456901752e-08,-3.39188239435125351e-09, 5.55980217683684310e-10,
+        -1.01642337479136637e-10, 2.03737632437062631e-11,-4.41920223085237075e-12,
+         1.02659796048993387e-12,-2.53299593824221798e-13, 6.59326143215375332e-14,
+        -1.80038411479524485e-14, 5.13306031794252826e-15
+    };
+    // Number of points between exact evaluations of sin and cos in the rotation recurrence,
+    // which limits the accumulated round-off to a few times the machine precision.
+    int const recurrenceBlock = 8;
+    // Number of values processed together by the vectorized loops.
+    int const blockSize = 64;
+    // Evaluates the Chebyshev series c[0] + Sum[c[k] T_k(t), {k,1,N-1}] with Clenshaw's recurrence,
+    // which is unrolled at compile time so that loops over many values of t can be vectorized.
+    template <int K> struct Clenshaw {
+        static double evaluate(double const *c, double twot, double b1, double b2) {
+            return Clenshaw<K-1>::evaluate(c,twot,c[K] + twot*b1 - b2,b1);
+        }
+    };
+    template <> struct Clenshaw<0> {
+        static double evaluate(double const *c, double twot, double b1, double b2) {
+            return c[0] + 0.5*twot*b1 - b2;
+        }
+    };
+    template <int N> inline double chebyshev(double const *c, double t) {
+        return Clenshaw<N-1>::evaluate(c,2*t,0,0);
+    }
+}} // baofit::si
+
+void local::getSineIntegrals(int n, double x0, double dx, double *sinx, double *cosx, double *si) {
+    double sinStep(std::sin(dx)), cosStep(std::cos(dx));
+    for(int i = 0; i < n; ++i) {
+        double x = x0 + i*dx;
+        if(0 == i % si::recurrenceBlock) {
+            sinx[i] = std::sin(x);
+            cosx[i] = std::cos(x);
+        }
+        else {
+            sinx[i] = sinx[i-1]*cosStep + cosx[i-1]*sinStep;
+            cosx[i] = cosx[i-1]*cosStep - sinx[i-1]*sinStep;
+        }
+        // Use the output array to hold the x values.
+        si[i] = x;
+    }
+    getSineIntegrals(n,si,sinx,cosx,si);
+}
+
+void local::getSineIntegrals(int n, double const *x, double const *sinx, double const *cosx, double *si) {
+    double const halfpi(2*std::atan(1)), xSplitSq(si::xSplit*si::xSplit), invxMax(1/si::xSplit);
+    // We calculate both forms for every x and then select the appropriate one. Each step is a
+    // separate loop over a block of values so that the compiler does not reintroduce branches.
+    double series[si::blockSize], positive[si::blockSize], negative[si::blockSize];
+    for(int first = 0; first < n; first += si::blockSize) {
+        int size = std::min(si::blockSize,n - first);
+        double const *xb(x + first), *sinb(sinx + first), *cosb(cosx + first);
+        double *sib(si + first);
+        // Calculate u = (x/xSplit)^2 for the series and 1/|x| for the asymptotic form, clamped
+        // to their valid ranges.
+        for(int i = 0; i < size; ++i) {
+            double u = xb[i]*xb[i]/xSplitSq, invx = 1/std::fabs(xb[i]);
+            series[i] = (u < 1) ? u : 1;
+            positive[i] = (invx < invxMax) ? invx : invxMax;
+        }
+        // Evaluate the series and the asymptotic form for x > 0 and x < 0, using Si(-x) = -Si(x).
+        for(int i = 0; i < size; ++i) {
+            double u(series[i]), invx(positive[i]), t(2*xSplitSq*invx*invx - 1);
+            double f = si::chebyshev<si::nF>(si::cF,t)*invx;
+            double g = si::chebyshev<si::nG>(si::cG,t)*invx*invx;
+            series[i] = xb[i]*si::chebyshev<si::nS>(si::cS,2*u - 1);
+            positive[i] = halfpi - f*cosb[i] - g*sinb[i];
+            negative[i] = -halfpi + f*cosb[i] - g*sinb[i];
+        }
+        // Select the appropriate form.
+        for(int i = 0; i < size; ++i) {
+            double asymptotic = (xb[i] < 0) ? negative[i] : positive[i];
+            sib[i] = (std::fabs(xb[i]) < si::xSplit) ? series[i] : asymptotic;
+        }
+    }
+}
+
+double local::compareSineIntegrals(int n, double const *x, double const *si) {
+    double maxError(0);
+    gsl_sf_result reference;
+    for(int i = 0; i < n; ++i) {
+        gsl_sf_Si_e(x[i],&reference);
+        maxError = std::max(maxError,std::fabs(si[i] - reference.val) - reference.err);
+    }
+    return maxError;
+}
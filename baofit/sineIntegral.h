@@ -0,0 +1,26 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#ifndef BAOFIT_SINE_INTEGRAL
+#define BAOFIT_SINE_INTEGRAL
+
+namespace baofit {
+    // Bound on the absolute error of the sine integrals calculated below for |x| <= 500, which
+    // covers k*r for any of our models. The largest error measured with both methods below, for
+    // 20000 random x and 4000 recurrence steps over this range compared with the power series of
+    // Si(x) summed with 40+ significant digits, was 1.1e-15 (5 ulp of Si(x) ~ 1.8).
+    double const sineIntegralAccuracy = 2e-15;
+    // Fills sinx[i], cosx[i] and si[i] with sin(x), cos(x) and the sine integral Si(x) for the
+    // n uniformly spaced values x = x0 + i*dx, using a rotation recurrence for sin and cos that
+    // only calls the standard library once every few points.
+    void getSineIntegrals(int n, double x0, double dx, double *sinx, double *cosx, double *si);
+    // Fills si[0..n-1] with the sine integral Si(x[i]) using the previously calculated values
+    // sinx[i] = sin(x[i]) and cosx[i] = cos(x[i]). The calculation has no branches so that it
+    // can be vectorized. The output array si can be the same as the input array x.
+    void getSineIntegrals(int n, double const *x, double const *sinx, double const *cosx, double *si);
+    // Returns the largest absolute difference between si[i] and gsl_sf_Si(x[i]) for i = 0..n-1,
+    // after subtracting the error that GSL estimates for its own value, so that the result
+    // should never exceed sineIntegralAccuracy.
+    double compareSineIntegrals(int n, double const *x, double const *si);
+} // baofit
+
+#endif // BAOFIT_SINE_INTEGRAL
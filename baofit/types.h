@@ -15,6 +15,24 @@ namespace baofit {
     typedef boost::shared_ptr<AbsCorrelationData> AbsCorrelationDataPtr;    
     typedef boost::shared_ptr<const AbsCorrelationData> AbsCorrelationDataCPtr;    
 
+    class EvaluationContext;
+    typedef boost::shared_ptr<EvaluationContext> EvaluationContextPtr;
+
+    class FitProfile;
+    typedef boost::shared_ptr<FitProfile> FitProfilePtr;
+
+    class UniformSpline;
+    typedef boost::shared_ptr<UniformSpline> UniformSplinePtr;
+
+    class ModelPack;
+    typedef boost::shared_ptr<ModelPack> ModelPackPtr;
+
+    class FFTLog;
+    typedef boost::shared_ptr<FFTLog> FFTLogPtr;
+
+    class PeakBroadening;
+    typedef boost::shared_ptr<PeakBroadening> PeakBroadeningPtr;
+
 } // baofit
 
 #endif // BAOFIT_TYPES
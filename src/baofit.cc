@@ -29,13 +29,13 @@ int main(int argc, char **argv) {
 
     double OmegaMatter,hubbleConstant,zref,minll,maxll,dll,dll2,minsep,dsep,minz,dz,rmin,rmax,
         rVetoWidth,rVetoCenter,xiRmin,xiRmax,muMin,muMax,kloSpline,khiSpline,toymcScale,saveICovScale,
-        zMin,zMax,llMin,llMax,sepMin,sepMax,distR0;
+        zMin,zMax,llMin,llMax,sepMin,sepMax,distR0,templateAccuracy;
     int nsep,nz,maxPlates,bootstrapTrials,bootstrapSize,randomSeed,ndump,jackknifeDrop,lmin,lmax,
         mcmcSave,mcmcInterval,toymcSamples,xiNr,reuseCov,nSpline,splineOrder,bootstrapCovTrials,
-        projectModesNKeep;
+        projectModesNKeep,nthreads,likelihoodCache,binIntegration;
     std::string modelrootName,fiducialName,nowigglesName,dataName,xiPoints,toymcConfig,
         platelistName,platerootName,iniName,refitConfig,minMethod,xiMethod,outputPrefix,altConfig,
-        fixModeScales,distAdd,distMul;
+        fixModeScales,distAdd,distMul,modelPackName;
     std::vector<std::string> modelConfig;
 
     // Default values in quotes below are to avoid roundoff errors leading to ugly --help
@@ -57,6 +57,8 @@ int main(int argc, char **argv) {
             "No-wiggles correlation functions will be read from <name>.<ell>.dat with ell=0,2,4.")
         ("modelroot", po::value<std::string>(&modelrootName)->default_value(""),
             "Common path to prepend to all model filenames.")
+        ("model-pack", po::value<std::string>(&modelPackName)->default_value(""),
+            "Reads precomputed model tables from the named binary file created with baofitpack.")
         ("zref", po::value<double>(&zref)->default_value(2.25),
             "Reference redshift used by model correlation functions.")
         ("dist-add", po::value<std::string>(&distAdd)->default_value(""),
@@ -74,6 +76,8 @@ int main(int argc, char **argv) {
         ("order-spline", po::value<int>(&splineOrder)->default_value(3),
             "Order of B-spline in k P(k).")
         ("multi-spline", "Fits independent parameters for each multipole.")
+        ("validate-si", "Compares the spline model sine integrals with gsl_sf_Si as they are calculated "
+            "and fails if any exceeds the documented accuracy.")
         ("xi-points", po::value<std::string>(&xiPoints)->default_value(""),
             "Comma-separated list of r values (Mpc/h) to use for interpolating r^2 xi(r)")
         ("xi-method", po::value<std::string>(&xiMethod)->default_value("cspline"),
@@ -84,6 +88,10 @@ int main(int argc, char **argv) {
             "Parameter adjustments for dumping alternate best-fit model.")
         ("anisotropic", "Uses anisotropic scale parameters instead of an isotropic scale.")
         ("decoupled", "Only applies scale factors to BAO peak and not cosmological broadband.")
+        ("nl-broadening", "Calculates the BAO peak from the fiducial and nowiggles <name>_matterpower.dat "
+            "with a fitted Gaussian damping (BAO Sigma-par, BAO Sigma-perp).")
+        ("template-accuracy", po::value<double>(&templateAccuracy)->default_value(1e-6,"1e-6"),
+            "Relative accuracy of uniform-grid interpolation of fiducial and no-wiggles models.")
         ;
     dataOptions.add_options()
         ("data", po::value<std::string>(&dataName)->default_value(""),
@@ -210,7 +218,18 @@ int main(int argc, char **argv) {
         ("random-seed", po::value<int>(&randomSeed)->default_value(1966),
             "Random seed to use for generating bootstrap samples.")
         ("min-method", po::value<std::string>(&minMethod)->default_value("mn2::vmetric"),
-            "Minimization method to use for fitting.")
+            "Minimization method to use for fitting (use baofit::lm for Levenberg-Marquardt, whose "
+            "Gauss-Newton errors can differ from mn2 errors for strongly non-linear models).")
+        ("threads", po::value<int>(&nthreads)->default_value(1),
+            "Number of threads to use for calculating model predictions during each fit.")
+        ("analytic-broadband",
+            "Solves for linear broadband distortion coefficients analytically during each fit "
+            "((r,mu) binned data with Gaussian priors only).")
+        ("likelihood-cache", po::value<int>(&likelihoodCache)->default_value(0),
+            "Number of recent likelihood values to cache during each fit (zero for no caching).")
+        ("bin-integration", po::value<int>(&binIntegration)->default_value(1),
+            "Averages predictions over each (r,mu) bin using NxN quadrature nodes (1 uses bin centers).")
+        ("profile", "Reports where the time goes in each fit and saves it to <output-prefix>profile.dat.")
         ;
 
     allOptions.add(genericOptions).add(modelOptions).add(dataOptions)
@@ -262,7 +281,9 @@ int main(int argc, char **argv) {
         fixAlnCov(vm.count("fix-aln-cov")), saveData(vm.count("save-data")),
         scalarWeights(vm.count("scalar-weights")), noInitialFit(vm.count("no-initial-fit")),
         compareEach(vm.count("compare-each")), compareEachFinal(vm.count("compare-each-final")),
-        decoupled(vm.count("decoupled"));
+        decoupled(vm.count("decoupled")), analyticBroadband(vm.count("analytic-broadband")),
+        profile(vm.count("profile")), nlBroadening(vm.count("nl-broadening")),
+        validateSi(vm.count("validate-si"));
 
     // Check for the required filename parameters.
     if(0 == dataName.length() && 0 == platelistName.length()) {
@@ -282,12 +303,23 @@ int main(int argc, char **argv) {
     }
     cosmo::Multipole ellmax = static_cast<cosmo::Multipole>(lmax);
 
+    // Check that analytic broadband is only requested for (r,mu) binned data.
+    if(analyticBroadband && (french || dr9lrg || xiFormat)) {
+        std::cerr << "Option --analytic-broadband is not supported for multipole data." << std::endl;
+        return -1;
+    }
+
     // Calculate veto window.
     double rVetoMin = rVetoCenter - 0.5*rVetoWidth, rVetoMax = rVetoCenter + 0.5*rVetoWidth;
 
     // Initialize our analyzer.
     likely::Random::instance()->setSeed(randomSeed);
     baofit::CorrelationAnalyzer analyzer(minMethod,rmin,rmax,verbose,scalarWeights);
+    analyzer.setNThreads(nthreads);
+    analyzer.setAnalyticLinearParameters(analyticBroadband);
+    analyzer.setLikelihoodCacheSize(likelihoodCache);
+    analyzer.setBinIntegration(binIntegration);
+    if(profile) analyzer.setProfileName(outputPrefix + "profile.dat");
 
     // Initialize the fit model we will use.
     cosmo::AbsHomogeneousUniversePtr cosmology;
@@ -297,8 +329,11 @@ int main(int argc, char **argv) {
         cosmology.reset(new cosmo::LambdaCdmRadiationUniverse(OmegaMatter,0,hubbleConstant));
         
         if(nSpline > 0) {
-            model.reset(new baofit::PkCorrelationModel(modelrootName,nowigglesName,
-                kloSpline,khiSpline,nSpline,splineOrder,multiSpline,zref));
+            boost::shared_ptr<baofit::PkCorrelationModel> pkModel(new baofit::PkCorrelationModel(
+                modelrootName,nowigglesName,kloSpline,khiSpline,nSpline,splineOrder,multiSpline,zref,
+                templateAccuracy,modelPackName));
+            pkModel->setSineIntegralValidation(validateSi);
+            model = pkModel;
         }
         else if(xiPoints.length() > 0) {
             model.reset(new baofit::XiCorrelationModel(xiPoints,zref,xiMethod));
@@ -306,7 +341,8 @@ int main(int argc, char **argv) {
         else {
             // Build our fit model from tabulated ell=0,2,4 correlation functions on disk.
             model.reset(new baofit::BaoCorrelationModel(
-                modelrootName,fiducialName,nowigglesName,distAdd,distMul,distR0,zref,anisotropic,decoupled));
+                modelrootName,fiducialName,nowigglesName,distAdd,distMul,distR0,zref,anisotropic,decoupled,
+                templateAccuracy,modelPackName,nlBroadening));
         }
              
         // Configure our fit model parameters by applying all model-config options in turn,
@@ -489,7 +525,7 @@ int main(int argc, char **argv) {
         // Fit the combined sample or use the initial model-config.
         likely::FunctionMinimumPtr fmin;
         if(noInitialFit) {
-            baofit::CorrelationFitter fitter(combined,model);
+            baofit::CorrelationFitter fitter(combined,model,nthreads);
             fmin = fitter.guess();
         }
         else {
@@ -610,6 +646,10 @@ int main(int argc, char **argv) {
             std::string outName = outputPrefix + "each.dat";
             analyzer.fitEach(fmin,fmin2,refitConfig,outName,ndump);
         }
+        // Report on how effectively the k-space model reused its sine integrals.
+        if(verbose && nSpline > 0) {
+            boost::dynamic_pointer_cast<baofit::PkCorrelationModel>(model)->printCacheStatistics(std::cout);
+        }
     }
     catch(std::runtime_error const &e) {
         std::cerr << "ERROR during analysis:\n  " << e.what() << std::endl;
@@ -0,0 +1,280 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/baofit.h"
+#include "baofit/boss.h"
+#include "cosmo/cosmo.h"
+#include "likely/likely.h"
+
+#include "boost/program_options.hpp"
+#include "boost/format.hpp"
+#include "boost/foreach.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+namespace po = boost::program_options;
+
+namespace baofit {
+namespace bench {
+    // Prints one line of our throughput table to the specified output stream.
+    void report(std::ostream &out, std::string const &name, double elapsed, long count,
+    std::string const &units) {
+        static boost::format row("%-20s %10.4f s %10d %-12s %12.2f %s/s\n");
+        double rate = elapsed > 0 ? count/elapsed : 0;
+        out << row % name % elapsed % count % units % rate % units;
+    }
+    // Applies each of the configuration scripts provided to the specified model.
+    void configure(AbsCorrelationModelPtr model, std::vector<std::string> const &configs) {
+        BOOST_FOREACH(std::string const &config, configs) {
+            try {
+                model->configureFitParameters(config);
+            }
+            catch(std::runtime_error const &e) {
+                std::cerr << "Ignoring model-config \"" << config << "\": " << e.what() << std::endl;
+            }
+        }
+    }
+    // Fits the data with the specified model and prints the fit throughput, using the best of
+    // nrepeat identical fits. Returns the last function minimum.
+    likely::FunctionMinimumPtr fit(std::ostream &out, std::string const &name, AbsCorrelationDataCPtr data,
+    AbsCorrelationModelPtr model, std::string const &method, int nthreads, int nrepeat) {
+        likely::FunctionMinimumPtr fmin;
+        FitProfilePtr profile(new FitProfile()), best;
+        for(int repeat = 0; repeat < nrepeat; ++repeat) {
+            CorrelationFitter fitter(data,model,nthreads);
+            fitter.setProfile(profile);
+            fmin = fitter.fit(method);
+            if(!best || profile->getFitTime() < best->getFitTime()) best.reset(new FitProfile(*profile));
+        }
+        report(out,name,best->getFitTime(),best->getNEvaluations(),"evals");
+        return fmin;
+    }
+} // bench
+} // baofit
+
+int main(int argc, char **argv) {
+
+    // Configure option processing
+    po::options_description allOptions("Benchmarks a fixed set of baofit workloads using the demo dataset"),
+        benchOptions("Benchmark options"), iniOptions("Options read from the INI file");
+
+    double OmegaMatter,hubbleConstant,zref,minll,maxll,dll,dll2,minsep,dsep,minz,dz,rmin,rmax,
+        kloSpline,khiSpline;
+    int nsep,nz,nrepeat,toymcSamples,mcmcSteps,nthreads,nSpline,splineOrder,randomSeed;
+    std::string iniName,modelrootName,fiducialName,nowigglesName,pkNowigglesName,dataName,
+        xiPoints,minMethod;
+    std::vector<std::string> modelConfig;
+
+    benchOptions.add_options()
+        ("help,h", "Prints this info and exits.")
+        ("ini-file,i", po::value<std::string>(&iniName)->default_value("../config/demo.ini"),
+            "Loads the demo data and BAO model options from the specified INI file.")
+        ("repeat", po::value<int>(&nrepeat)->default_value(3),
+            "Number of times to repeat each short workload, reporting the fastest.")
+        ("toymc-samples", po::value<int>(&toymcSamples)->default_value(100),
+            "Number of toy MC samples to generate and fit.")
+        ("mcmc-steps", po::value<int>(&mcmcSteps)->default_value(1000),
+            "Number of Markov chain steps to generate.")
+        ("threads", po::value<int>(&nthreads)->default_value(1),
+            "Number of threads to use for calculating model predictions during each fit.")
+        ("min-method", po::value<std::string>(&minMethod)->default_value("mn2::vmetric"),
+            "Minimization method to use for fitting.")
+        ("random-seed", po::value<int>(&randomSeed)->default_value(1966),
+            "Random seed to use for generating toy MC samples and Markov chains.")
+        ("pk-nowiggles", po::value<std::string>(&pkNowigglesName)->default_value("EH98NoWiggles"),
+            "No-wiggles model to use for the P(k) spline fit.")
+        ("n-spline", po::value<int>(&nSpline)->default_value(21),
+            "Number of spline knots to use for the P(k) spline fit.")
+        ("klo-spline", po::value<double>(&kloSpline)->default_value(0.03,"0.03"),
+            "Minimum k in h/Mpc for the P(k) spline fit.")
+        ("khi-spline", po::value<double>(&khiSpline)->default_value(0.33,"0.33"),
+            "Maximum k in h/Mpc for the P(k) spline fit.")
+        ("order-spline", po::value<int>(&splineOrder)->default_value(1),
+            "Order of B-spline for the P(k) spline fit.")
+        ("xi-points", po::value<std::string>(&xiPoints)->default_value(
+            "40,60,80,85,90,95,100,104,108,112,116,120,125,130,140,160,190"),
+            "Comma-separated list of r values (Mpc/h) to use for the Xi points fit.")
+        ;
+    iniOptions.add_options()
+        ("omega-matter", po::value<double>(&OmegaMatter)->default_value(0.27,"0.27"),
+            "Present-day value of OmegaMatter.")
+        ("hubble-constant", po::value<double>(&hubbleConstant)->default_value(0.7,"0.7"),
+            "Present-day value of the Hubble parameter h = H0/(100 km/s/Mpc).")
+        ("modelroot", po::value<std::string>(&modelrootName)->default_value("../models/"),
+            "Common path to prepend to all model filenames.")
+        ("fiducial", po::value<std::string>(&fiducialName)->default_value("DR9LyaMocks"),
+            "Fiducial correlation functions will be read from <name>.<ell>.dat with ell=0,2,4.")
+        ("nowiggles", po::value<std::string>(&nowigglesName)->default_value("DR9LyaMocksSB"),
+            "No-wiggles correlation functions will be read from <name>.<ell>.dat with ell=0,2,4.")
+        ("zref", po::value<double>(&zref)->default_value(2.25),
+            "Reference redshift used by model correlation functions.")
+        ("model-config", po::value<std::vector<std::string> >(&modelConfig)->composing(),
+            "BAO model parameters configuration script (option can appear multiple times).")
+        ("data", po::value<std::string>(&dataName)->default_value("../demo/Aln2"),
+            "Cosmolib saved-format data will be read from <name>.data and <name>.icov.")
+        ("minll", po::value<double>(&minll)->default_value(0.05,"0.05"),
+            "Minimum log(lam2/lam1).")
+        ("maxll", po::value<double>(&maxll)->default_value(0.27,"0.27"),
+            "Maximum log(lam2/lam1).")
+        ("dll", po::value<double>(&dll)->default_value(0.02,"0.02"),
+            "log(lam2/lam1) binsize.")
+        ("dll2", po::value<double>(&dll2)->default_value(0.002,"0.002"),
+            "log(lam2/lam1) second binsize parameter for two-step binning.")
+        ("minsep", po::value<double>(&minsep)->default_value(0),
+            "Minimum separation in arcmins.")
+        ("dsep", po::value<double>(&dsep)->default_value(10),
+            "Separation binsize in arcmins.")
+        ("nsep", po::value<int>(&nsep)->default_value(18),
+            "Maximum number of separation bins.")
+        ("minz", po::value<double>(&minz)->default_value(1.75,"1.75"),
+            "Minimum redshift.")
+        ("dz", po::value<double>(&dz)->default_value(0.5,"0.5"),
+            "Redshift binsize.")
+        ("nz", po::value<int>(&nz)->default_value(3),
+            "Maximum number of redshift bins.")
+        ("rmin", po::value<double>(&rmin)->default_value(50),
+            "Final cut on minimum 3D comoving separation (Mpc/h) to use in fit.")
+        ("rmax", po::value<double>(&rmax)->default_value(170),
+            "Final cut on maximum 3D comoving separation (Mpc/h) to use in fit.")
+        ;
+    allOptions.add(benchOptions).add(iniOptions);
+    po::variables_map vm;
+
+    // Parse command line options first so they override anything in the INI file. Any INI file
+    // options that we do not use are ignored.
+    try {
+        po::store(po::parse_command_line(argc, argv, allOptions), vm);
+        po::notify(vm);
+        if(vm.count("help")) {
+            std::cout << allOptions << std::endl;
+            return 1;
+        }
+        if(0 < iniName.length()) {
+            std::ifstream iniFile(iniName.c_str());
+            if(!iniFile.good()) {
+                std::cerr << "Unable to open INI file " << iniName << std::endl;
+                return -1;
+            }
+            po::store(po::parse_config_file(iniFile, allOptions, true), vm);
+            iniFile.close();
+            po::notify(vm);
+        }
+    }
+    catch(std::exception const &e) {
+        std::cerr << "Unable to parse options: " << e.what() << std::endl;
+        return -1;
+    }
+    if(nrepeat < 1 || toymcSamples < 1 || mcmcSteps < 1) {
+        std::cerr << "Expected repeat, toymc-samples and mcmc-steps to all be > 0." << std::endl;
+        return -1;
+    }
+
+    // Our results are collected in a table that is printed after any output from the workloads.
+    likely::Random::instance()->setSeed(randomSeed);
+    std::ostringstream table;
+    table << boost::format("%-20s %12s %10s %-12s %14s\n")
+        % "workload" % "time" % "count" % "units" % "throughput";
+
+    try {
+        double start, elapsed;
+        cosmo::AbsHomogeneousUniversePtr cosmology(
+            new cosmo::LambdaCdmRadiationUniverse(OmegaMatter,0,hubbleConstant));
+
+        // Time the construction of the BAO model, which is dominated by reading its tabulated models.
+        baofit::AbsCorrelationModelPtr baoModel;
+        elapsed = 0;
+        for(int repeat = 0; repeat < nrepeat; ++repeat) {
+            start = baofit::FitProfile::getWallTime();
+            baoModel.reset(new baofit::BaoCorrelationModel(
+                modelrootName,fiducialName,nowigglesName,"","",100,zref));
+            double dt = baofit::FitProfile::getWallTime() - start;
+            if(0 == repeat || dt < elapsed) elapsed = dt;
+        }
+        baofit::bench::report(table,"model construction",elapsed,1,"models");
+        baofit::bench::configure(baoModel,modelConfig);
+
+        // Time the loading of the demo data and its inverse covariance.
+        baofit::AbsCorrelationDataPtr prototype = baofit::boss::createCosmolibPrototype(
+            minsep,dsep,nsep,minz,dz,nz,minll,maxll,dll,dll2,0,1,0,200,false,cosmology);
+        prototype->setFinalCuts(rmin,rmax,0,0,0,1,cosmo::Monopole,cosmo::Quadrupole,0,10);
+        baofit::AbsCorrelationDataPtr data;
+        elapsed = 0;
+        for(int repeat = 0; repeat < nrepeat; ++repeat) {
+            start = baofit::FitProfile::getWallTime();
+            data = baofit::boss::loadCosmolibSaved(dataName,prototype,false);
+            double dt = baofit::FitProfile::getWallTime() - start;
+            if(0 == repeat || dt < elapsed) elapsed = dt;
+        }
+        baofit::bench::report(table,"data load",elapsed,data->getNBinsWithData(),"bins");
+
+        // Time the finalizing of the data, which applies our final cuts.
+        baofit::CorrelationAnalyzer analyzer(minMethod,rmin,rmax,false);
+        analyzer.setNThreads(nthreads);
+        analyzer.addData(data,-1);
+        analyzer.setZData(2.25);
+        baofit::AbsCorrelationDataPtr combined;
+        elapsed = 0;
+        for(int repeat = 0; repeat < nrepeat; ++repeat) {
+            start = baofit::FitProfile::getWallTime();
+            combined = analyzer.getCombined(false,true);
+            double dt = baofit::FitProfile::getWallTime() - start;
+            if(0 == repeat || dt < elapsed) elapsed = dt;
+        }
+        baofit::bench::report(table,"finalize",elapsed,combined->getNBinsWithData(),"bins");
+
+        // Time one full fit with each type of model.
+        likely::FunctionMinimumPtr fmin = baofit::bench::fit(table,"BAO fit",combined,baoModel,
+            minMethod,nthreads,nrepeat);
+        {
+            baofit::AbsCorrelationModelPtr pkModel(new baofit::PkCorrelationModel(modelrootName,
+                pkNowigglesName,kloSpline,khiSpline,nSpline,splineOrder,false,zref));
+            std::vector<std::string> pkConfig;
+            pkConfig.push_back("fix[beta]=1.4; fix[(1+beta)*bias]=-0.336;");
+            pkConfig.push_back("fix[gamma-bias]=3.8; fix[gamma-beta]=0;");
+            pkConfig.push_back("gaussprior[Pk b-*] @ (-1000,+1000);");
+            baofit::bench::configure(pkModel,pkConfig);
+            baofit::bench::fit(table,"P(k) spline fit",combined,pkModel,minMethod,nthreads,nrepeat);
+        }
+        {
+            baofit::AbsCorrelationModelPtr xiModel(new baofit::XiCorrelationModel(xiPoints,zref,"linear"));
+            std::vector<std::string> xiConfig;
+            xiConfig.push_back("fix[beta]=1.4; fix[(1+beta)*bias]=-0.336;");
+            xiConfig.push_back("fix[gamma-bias]=3.8; fix[gamma-beta]=0;");
+            baofit::bench::configure(xiModel,xiConfig);
+            baofit::bench::fit(table,"Xi points fit",combined,xiModel,minMethod,nthreads,nrepeat);
+        }
+
+        {
+            // Fit the BAO peak with nonlinear broadening, floating its damping scales.
+            baofit::AbsCorrelationModelPtr nlModel(new baofit::BaoCorrelationModel(
+                modelrootName,fiducialName,nowigglesName,"","",100,zref,false,false,1e-6,"",true));
+            baofit::bench::configure(nlModel,modelConfig);
+            baofit::bench::fit(table,"NL broadening fit",combined,nlModel,minMethod,nthreads,nrepeat);
+        }
+
+        // Time the generation and fitting of toy MC samples using the BAO model.
+        analyzer.setModel(baoModel);
+        start = baofit::FitProfile::getWallTime();
+        analyzer.doToyMCSampling(toymcSamples,"","",1,fmin,likely::FunctionMinimumPtr(),"","",0);
+        elapsed = baofit::FitProfile::getWallTime() - start;
+        baofit::bench::report(table,"toy MC fits",elapsed,toymcSamples,"fits");
+
+        // Time the generation of a Markov chain using the BAO model.
+        start = baofit::FitProfile::getWallTime();
+        analyzer.generateMarkovChain(mcmcSteps,1,fmin);
+        elapsed = baofit::FitProfile::getWallTime() - start;
+        baofit::bench::report(table,"MCMC",elapsed,mcmcSteps,"steps");
+    }
+    catch(std::runtime_error const &e) {
+        std::cerr << "ERROR during benchmark:\n  " << e.what() << std::endl;
+        return -2;
+    }
+    std::cout << std::endl << table.str();
+
+    // All done: normal exit
+    return 0;
+}
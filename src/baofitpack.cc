@@ -0,0 +1,101 @@
+// Created 16-Oct-2026 by David Kirkby (University of California, Irvine) <dkirkby@uci.edu>
+
+#include "baofit/baofit.h"
+
+#include "boost/program_options.hpp"
+#include "boost/format.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+namespace po = boost::program_options;
+
+// Packs the tabulated models of one model family into a binary file that can be memory mapped
+// by baofit using its --model-pack option.
+int main(int argc, char **argv) {
+
+    // Configure command-line option processing
+    po::options_description allOptions("Model pack options");
+    double templateAccuracy;
+    std::string modelrootName,fiducialName,nowigglesName,outputName,iniName;
+    allOptions.add_options()
+        ("help,h", "Prints this info and exits.")
+        ("quiet,q", "Runs silently unless there is a problem.")
+        ("ini-file,i", po::value<std::string>(&iniName)->default_value(""),
+            "Loads options from specified INI file (command line has priority).")
+        ("fiducial", po::value<std::string>(&fiducialName)->default_value(""),
+            "Fiducial correlation functions will be read from <name>.<ell>.dat with ell=0,2,4.")
+        ("nowiggles", po::value<std::string>(&nowigglesName)->default_value(""),
+            "No-wiggles correlation functions will be read from <name>.<ell>.dat with ell=0,2,4.")
+        ("modelroot", po::value<std::string>(&modelrootName)->default_value(""),
+            "Common path to prepend to all model filenames.")
+        ("template-accuracy", po::value<double>(&templateAccuracy)->default_value(1e-6,"1e-6"),
+            "Relative accuracy of uniform-grid interpolation of fiducial and no-wiggles models.")
+        ("output", po::value<std::string>(&outputName)->default_value(""),
+            "Name of the model pack file to create.")
+        ;
+    po::variables_map vm;
+
+    // Parse command line options first so they override anything in the INI file. Any INI file
+    // options that we do not use are ignored.
+    try {
+        po::store(po::parse_command_line(argc, argv, allOptions), vm);
+        po::notify(vm);
+        if(vm.count("help")) {
+            std::cout << allOptions << std::endl;
+            return 1;
+        }
+        if(0 < iniName.length()) {
+            std::ifstream iniFile(iniName.c_str());
+            if(!iniFile.good()) {
+                std::cerr << "Unable to open INI file " << iniName << std::endl;
+                return -1;
+            }
+            po::store(po::parse_config_file(iniFile, allOptions, true), vm);
+            iniFile.close();
+            po::notify(vm);
+        }
+    }
+    catch(std::exception const &e) {
+        std::cerr << "Unable to parse options: " << e.what() << std::endl;
+        return -1;
+    }
+    bool verbose(0 == vm.count("quiet"));
+    if(0 == fiducialName.length() || 0 == nowigglesName.length() || 0 == outputName.length()) {
+        std::cerr << "Missing required fiducial, nowiggles or output option." << std::endl;
+        return -1;
+    }
+
+    // Build and save the pack, then read it back to check it.
+    try {
+        baofit::ModelPack::create(outputName,modelrootName,fiducialName,nowigglesName,templateAccuracy);
+        baofit::ModelPack pack(outputName);
+        if(verbose) {
+            boost::format line("%-16s %2d functions %6d points on [%g,%g]%s with max error %.2g\n");
+            std::cout << "Created " << outputName << " (version " << baofit::ModelPack::version
+                << ") for " << pack.getFiducialName() << " and " << pack.getNoWigglesName() << std::endl;
+            baofit::UniformSplinePtr spline = pack.getTemplates();
+            std::cout << line % "templates" % spline->getNFunctions() % spline->getNPoints()
+                % spline->getXMin() % spline->getXMax() % "" % spline->getMaxError();
+            spline = pack.getNoWigglesMultipoles();
+            std::cout << line % "nowiggles" % spline->getNFunctions() % spline->getNPoints()
+                % spline->getXMin() % spline->getXMax() % "" % spline->getMaxError();
+            if(pack.hasPower()) {
+                spline = pack.getNoWigglesPower();
+                std::cout << line % "nowiggles-power" % spline->getNFunctions() % spline->getNPoints()
+                    % spline->getXMin() % spline->getXMax() % " (log)" % spline->getMaxError();
+            }
+            else {
+                std::cout << "No power spectrum found for " << nowigglesName << std::endl;
+            }
+        }
+    }
+    catch(std::runtime_error const &e) {
+        std::cerr << "ERROR while creating model pack:\n  " << e.what() << std::endl;
+        return -2;
+    }
+
+    return 0;
+}